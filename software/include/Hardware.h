@@ -0,0 +1,126 @@
+// Hardware profiles of the soldering station
+//
+// A profile describes one board build: the pin map as port and bit, the level of the
+// heater pin that switches the MOSFET on, the OLED controller and the rotary encoder.
+// The firmware only uses the constexpr members and the static inline pin functions of
+// the selected profile, so every pin access compiles down to a single sbi, cbi or
+// sbis/sbic instruction and there is no runtime branching on the hardware type.
+//
+// The profile is selected with -D HW_PROFILE=<name> in the build_flags of the
+// PlatformIO environment (see platformio.ini); the default is StationV2.
+
+#ifndef HARDWARE_H
+#define HARDWARE_H
+
+#include <avr/io.h>
+#include <TwiByte.h>
+
+// I/O ports by their registers (input, output, direction)
+enum
+{
+  PORT_B,
+  PORT_C,
+  PORT_D
+};
+
+template <uint8_t P>
+struct Port;
+
+template <>
+struct Port<PORT_B>
+{
+  static volatile uint8_t &in() { return PINB; }
+  static volatile uint8_t &out() { return PORTB; }
+  static volatile uint8_t &dir() { return DDRB; }
+  static constexpr uint8_t first = 8; // Arduino pin number of bit 0
+};
+
+template <>
+struct Port<PORT_C>
+{
+  static volatile uint8_t &in() { return PINC; }
+  static volatile uint8_t &out() { return PORTC; }
+  static volatile uint8_t &dir() { return DDRC; }
+  static constexpr uint8_t first = 14;
+};
+
+template <>
+struct Port<PORT_D>
+{
+  static volatile uint8_t &in() { return PIND; }
+  static volatile uint8_t &out() { return PORTD; }
+  static volatile uint8_t &dir() { return DDRD; }
+  static constexpr uint8_t first = 0;
+};
+
+// digital pin with direct register access
+template <uint8_t P, uint8_t B>
+struct Pin
+{
+  static constexpr uint8_t port = P;
+  static constexpr uint8_t mask = 1 << B;
+  static constexpr uint8_t number = Port<P>::first + B; // Arduino pin number
+
+  static bool read() { return Port<P>::in() & mask; }
+  static void high() { Port<P>::out() |= mask; }
+  static void low() { Port<P>::out() &= ~mask; }
+  static void output() { Port<P>::dir() |= mask; }
+  static void input() { Port<P>::dir() &= ~mask; }
+  static void pullup()
+  {
+    input();
+    high();
+  }
+};
+
+// SolderingStation2 (v2.x boards) with P-channel heater switch, SSD1306 OLED and a rotary
+// encoder with 2 increments per step. The timer outputs and pin change interrupts used by
+// the firmware fix the heater (OC1A), buzzer (OC0B), encoder and handle switch pins.
+struct StationV2
+{
+  static constexpr uint8_t sensorChannel = 0; // ADC channel of the tip temperature sense (A0)
+  static constexpr uint8_t vinChannel = 1;    // ADC channel of the input voltage sense (A1)
+  typedef Pin<PORT_D, 5> Buzzer;              // buzzer (OC0B, D5)
+  typedef Pin<PORT_D, 6> Button;              // rotary encoder switch (D6)
+  typedef Pin<PORT_D, 7> Rotary1;             // rotary encoder 1 (D7)
+  typedef Pin<PORT_B, 0> Rotary2;             // rotary encoder 2 (D8)
+  typedef Pin<PORT_B, 1> Heater;              // heater MOSFET PWM control (OC1A, D9)
+  typedef Pin<PORT_B, 2> Switch;              // handle vibration switch (D10)
+
+  static constexpr bool heaterHigh = true;    // heater on while the pin is high (P-channel MOSFET)
+  static constexpr uint8_t rotaryShift = 0;   // 0: 2 increments/step; 1: 4 increments/step
+  typedef U8G2_SSD1306_128X64_NONAME_1_TWI Display;
+};
+
+// with N-channel heater switch: heater on while the pin is low
+struct StationV2N : StationV2
+{
+  static constexpr bool heaterHigh = false;
+};
+
+// with SH1106 OLED
+struct StationV2SH1106 : StationV2
+{
+  typedef U8G2_SH1106_128X64_NONAME_1_TWI Display;
+};
+
+// with rotary encoder of 4 increments per step
+struct StationV2R4 : StationV2
+{
+  static constexpr uint8_t rotaryShift = 1;
+};
+
+#ifndef HW_PROFILE
+#define HW_PROFILE StationV2
+#endif
+typedef HW_PROFILE Hardware;
+
+static_assert((Hardware::Heater::port == PORT_B) && (Hardware::Heater::mask == _BV(1)),
+              "Heater must be on OC1A (D9)!");
+static_assert((Hardware::Buzzer::port == PORT_D) && (Hardware::Buzzer::mask == _BV(5)),
+              "Buzzer must be on OC0B (D5)!");
+static_assert((Hardware::Rotary2::port == PORT_B) && (Hardware::Switch::port == PORT_B),
+              "Rotary encoder 2 and handle switch must be on port B (PCINT0 interrupt)!");
+static_assert(Hardware::Button::port == PORT_D, "Rotary encoder switch must be on port D (PCINT2 interrupt)!");
+
+#endif
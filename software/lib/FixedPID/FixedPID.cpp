@@ -0,0 +1,136 @@
+// FixedPID
+//
+// Integer PID controller, see FixedPID.h
+
+#include "FixedPID.h"
+
+// proportional and derivative terms beyond this (in 1/256) saturate the output anyway
+#define TERM_LIMIT (512L << 8)
+
+static int32_t clamp32(int32_t value, int32_t low, int32_t high)
+{
+  if (value < low)
+    return low;
+  if (value > high)
+    return high;
+  return value;
+}
+
+FixedPID::FixedPID(int16_t *input, uint8_t *output, uint16_t *setpoint,
+                   uint16_t Kp, uint16_t Ki, uint16_t Kd, uint8_t Direction)
+{
+  myInput = input;
+  myOutput = output;
+  mySetpoint = setpoint;
+  inAuto = false;
+  direction = Direction;
+  outMin = 0;
+  outMax = 255;
+  outputSum = 0;
+  feedForward = 0;
+  lastInput = 0;
+  sampleTime = 100; // same default as the floating point library
+  dispKp = Kp;
+  dispKi = Ki;
+  dispKd = Kd;
+  Scale();
+}
+
+// calculates a new output; has to be called once per sample time
+bool FixedPID::Compute()
+{
+  if (!inAuto)
+    return false;
+
+  // limit error and input change so that none of the products can overflow
+  int16_t input = *myInput;
+  int16_t error = clamp32((int16_t)*mySetpoint - input, -1024, 1024);
+  int16_t dInput = clamp32(input - lastInput, -512, 512);
+  if (direction == REVERSE)
+  {
+    error = -error;
+    dInput = -dInput;
+  }
+
+  // integral term with anti windup, limited to the range left by the feed-forward
+  int32_t bias = (int32_t)feedForward << 16;
+  outputSum = clamp32(outputSum + ki * error, ((int32_t)outMin << 16) - bias, ((int32_t)outMax << 16) - bias);
+
+  // proportional on error, derivative on measurement
+  int32_t pTerm = clamp32(kp * error, -TERM_LIMIT, TERM_LIMIT);
+  int32_t dTerm = clamp32(kd * dInput, -TERM_LIMIT, TERM_LIMIT);
+  int32_t output = bias + outputSum + (pTerm << 8) - (dTerm << 8);
+  output = clamp32(output, (int32_t)outMin << 16, (int32_t)outMax << 16);
+
+  *myOutput = (output + 0x8000) >> 16;
+  lastInput = input;
+  return true;
+}
+
+// sets the gains in 1/256; only rescales if they have changed
+void FixedPID::SetTunings(uint16_t Kp, uint16_t Ki, uint16_t Kd)
+{
+  if ((Kp == dispKp) && (Ki == dispKi) && (Kd == dispKd))
+    return;
+  dispKp = Kp;
+  dispKi = Ki;
+  dispKd = Kd;
+  Scale();
+}
+
+// sets the sample time in milliseconds the gains are scaled to
+void FixedPID::SetSampleTime(uint16_t ms)
+{
+  if (ms == 0)
+    return;
+  sampleTime = ms;
+  Scale();
+}
+
+void FixedPID::SetOutputLimits(uint8_t min, uint8_t max)
+{
+  if (min >= max)
+    return;
+  outMin = min;
+  outMax = max;
+  if (inAuto)
+  {
+    if (*myOutput > outMax)
+      *myOutput = outMax;
+    else if (*myOutput < outMin)
+      *myOutput = outMin;
+    int32_t bias = (int32_t)feedForward << 16;
+    outputSum = clamp32(outputSum, ((int32_t)outMin << 16) - bias, ((int32_t)outMax << 16) - bias);
+  }
+}
+
+// sets the feed-forward in output units; it is added to the output for DIRECT
+// and subtracted for REVERSE direction
+void FixedPID::SetFeedForward(uint8_t ff)
+{
+  feedForward = (direction == REVERSE) ? -(int16_t)ff : ff;
+}
+
+// switching from MANUAL to AUTOMATIC initializes the controller bumpless
+void FixedPID::SetMode(uint8_t mode)
+{
+  bool newAuto = (mode == AUTOMATIC);
+  if (newAuto && !inAuto)
+    Initialize();
+  inAuto = newAuto;
+}
+
+void FixedPID::Initialize()
+{
+  int32_t bias = (int32_t)feedForward << 16;
+  outputSum = clamp32(((int32_t)*myOutput << 16) - bias, ((int32_t)outMin << 16) - bias, ((int32_t)outMax << 16) - bias);
+  lastInput = *myInput;
+}
+
+// converts the gains into per sample factors
+void FixedPID::Scale()
+{
+  kp = dispKp;
+  ki = ((int32_t)dispKi << 8) * sampleTime / 1000;
+  kd = (int32_t)dispKd * 1000 / sampleTime;
+}
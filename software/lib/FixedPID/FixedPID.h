@@ -0,0 +1,61 @@
+// FixedPID
+//
+// Integer PID controller for the soldering station. Drop-in replacement for
+// the floating point PID library (br3ttb/PID) with the same algorithm:
+// proportional on error, derivative on measurement, integrator clamped to the
+// output limits. All arithmetic is done in 16/32 bit integers, so there is no
+// soft-float emulation on the ATmega328.
+//
+// Gains are given in 1/256 (Q8): Kp as is, Ki per second and Kd in seconds,
+// like in the original library. They are converted to per-sample factors
+// using the sample time. Compute() calculates a new output on every call, the
+// caller is responsible for calling it at the fixed sample rate.
+//
+// An optional feed-forward is added to the output in the controller direction;
+// the integrator only has to cover the remaining error.
+
+#ifndef FIXEDPID_H
+#define FIXEDPID_H
+
+#include <stdint.h>
+
+#define AUTOMATIC 1
+#define MANUAL 0
+#define DIRECT 0
+#define REVERSE 1
+
+class FixedPID
+{
+public:
+  FixedPID(int16_t *input, uint8_t *output, uint16_t *setpoint,
+           uint16_t kp, uint16_t ki, uint16_t kd, uint8_t direction);
+
+  void SetMode(uint8_t mode);                        // MANUAL or AUTOMATIC
+  void SetTunings(uint16_t kp, uint16_t ki, uint16_t kd); // gains in 1/256
+  void SetSampleTime(uint16_t ms);                  // sample time in milliseconds
+  void SetOutputLimits(uint8_t min, uint8_t max);
+  void SetFeedForward(uint8_t ff);                  // feed-forward in output units
+  bool Compute();                                   // returns false in MANUAL mode
+
+private:
+  void Initialize();
+  void Scale();
+
+  int16_t *myInput;
+  uint8_t *myOutput;
+  uint16_t *mySetpoint;
+
+  uint16_t dispKp, dispKi, dispKd; // gains as given in 1/256
+  int32_t kp;                      // proportional factor in 1/256
+  int32_t ki;                      // integral factor per sample in 1/65536
+  int32_t kd;                      // derivative factor per sample in 1/256
+  int32_t outputSum;               // integrator in 1/65536
+  int16_t feedForward;             // feed-forward in output units, signed by direction
+  int16_t lastInput;
+  uint16_t sampleTime;
+  uint8_t outMin, outMax;
+  uint8_t direction;
+  bool inAuto;
+};
+
+#endif
@@ -0,0 +1,128 @@
+// TwiByte
+//
+// Interrupt driven I2C (TWI) byte layer for U8g2, see TwiByte.h
+//
+// Each transfer is queued as a length byte followed by its data. The ISR sends
+// one transfer after the other, chained by repeated STARTs, and issues a STOP
+// when the queue runs empty.
+
+#include "TwiByte.h"
+
+#if TWI_QUEUE > 256
+#error TWI_QUEUE must not exceed 256 bytes!
+#endif
+
+static volatile uint8_t twiQueue[TWI_QUEUE];
+static volatile uint8_t twiHead; // end of the queued transfers (written by the caller)
+static volatile uint8_t twiTail; // next byte to send (written by the ISR)
+static volatile bool twiBusy;    // ISR is sending
+static uint8_t twiAddress;       // 8 bit write address of the display
+static uint8_t twiStart;         // position of the length byte of the transfer being queued
+static uint8_t twiPut;           // write position of the transfer being queued
+static uint8_t twiRemain;        // bytes left of the transfer being sent (ISR only)
+
+static uint8_t twiNext(uint8_t index)
+{
+  return (index + 1 < TWI_QUEUE) ? index + 1 : 0;
+}
+
+// appends a byte to the transfer being queued; waits if the queue is full
+static void twiPutByte(uint8_t value)
+{
+  uint8_t next = twiNext(twiPut);
+  while (next == twiTail)
+    ;
+  twiQueue[twiPut] = value;
+  twiPut = next;
+}
+
+bool twiIdle()
+{
+  return !twiBusy;
+}
+
+uint8_t u8x8_byte_twi_isr(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr)
+{
+  switch (msg)
+  {
+  case U8X8_MSG_BYTE_INIT:
+    digitalWrite(SDA, HIGH); // internal pull-ups like the Wire library
+    digitalWrite(SCL, HIGH);
+    TWSR = 0; // prescaler 1
+    TWBR = ((F_CPU / TWI_FREQ) - 16) / 2;
+    TWCR = bit(TWEN);
+    break;
+  case U8X8_MSG_BYTE_START_TRANSFER:
+    twiAddress = u8x8_GetI2CAddress(u8x8);
+    twiStart = twiPut;
+    twiPutByte(0); // length, set when the transfer is complete
+    break;
+  case U8X8_MSG_BYTE_SEND:
+  {
+    uint8_t *data = (uint8_t *)arg_ptr;
+    while (arg_int--)
+      twiPutByte(*data++);
+    break;
+  }
+  case U8X8_MSG_BYTE_END_TRANSFER:
+    twiQueue[twiStart] = (twiPut + TWI_QUEUE - twiStart - 1) % TWI_QUEUE;
+    noInterrupts();
+    twiHead = twiPut;
+    if (!twiBusy)
+    {
+      twiBusy = true;
+      while (TWCR & bit(TWSTO))
+        ; // wait for the last STOP to complete
+      TWCR = bit(TWINT) | bit(TWSTA) | bit(TWEN) | bit(TWIE);
+    }
+    interrupts();
+    break;
+  case U8X8_MSG_BYTE_SET_DC:
+    break;
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+// TWI interrupt service routine; sends the queued transfers
+ISR(TWI_vect)
+{
+  switch (TWSR & 0xF8)
+  {
+  case 0x08: // START transmitted
+  case 0x10: // repeated START transmitted
+    twiRemain = twiQueue[twiTail];
+    twiTail = twiNext(twiTail);
+    TWDR = twiAddress;
+    TWCR = bit(TWINT) | bit(TWEN) | bit(TWIE);
+    return;
+  case 0x18: // address transmitted, ACK received
+  case 0x28: // data transmitted, ACK received
+    if (twiRemain)
+    {
+      twiRemain--;
+      TWDR = twiQueue[twiTail];
+      twiTail = twiNext(twiTail);
+      TWCR = bit(TWINT) | bit(TWEN) | bit(TWIE);
+      return;
+    }
+    break;
+  default: // NACK or bus error: drop the rest of the transfer
+    while (twiRemain)
+    {
+      twiRemain--;
+      twiTail = twiNext(twiTail);
+    }
+    break;
+  }
+
+  // transfer complete: chain the next one or release the bus
+  if (twiTail != twiHead)
+    TWCR = bit(TWINT) | bit(TWSTA) | bit(TWEN) | bit(TWIE);
+  else
+  {
+    TWCR = bit(TWINT) | bit(TWSTO) | bit(TWEN);
+    twiBusy = false;
+  }
+}
@@ -0,0 +1,40 @@
+// TwiByte
+//
+// Interrupt driven I2C (TWI) byte layer for U8g2. The transfers of the display
+// driver are queued in a ring buffer and sent by the TWI interrupt in the
+// background, so the CPU keeps running while a page is on the bus. The caller
+// only has to wait if the queue is full; twiIdle() tells when it is empty.
+//
+// The display classes below are set up like the HW_I2C classes of U8g2, so
+// all drawing functions work unchanged.
+
+#ifndef TWIBYTE_H
+#define TWIBYTE_H
+
+#include <U8g2lib.h>
+
+#define TWI_FREQ 400000L // I2C clock in Hz
+#define TWI_QUEUE 192    // queue size in bytes (one page of 128 bytes plus transfer overhead)
+
+uint8_t u8x8_byte_twi_isr(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr);
+bool twiIdle(); // all queued transfers have been sent
+
+class U8G2_SSD1306_128X64_NONAME_1_TWI : public U8G2
+{
+public:
+  U8G2_SSD1306_128X64_NONAME_1_TWI(const u8g2_cb_t *rotation) : U8G2()
+  {
+    u8g2_Setup_ssd1306_i2c_128x64_noname_1(&u8g2, rotation, u8x8_byte_twi_isr, u8x8_gpio_and_delay_arduino);
+  }
+};
+
+class U8G2_SH1106_128X64_NONAME_1_TWI : public U8G2
+{
+public:
+  U8G2_SH1106_128X64_NONAME_1_TWI(const u8g2_cb_t *rotation) : U8G2()
+  {
+    u8g2_Setup_sh1106_i2c_128x64_noname_1(&u8g2, rotation, u8x8_byte_twi_isr, u8x8_gpio_and_delay_arduino);
+  }
+};
+
+#endif
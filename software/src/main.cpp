@@ -4,7 +4,7 @@
 //
 // This version of the code implements:
 // - Temperature measurement of the tip
-// - Direct or PID control of the heater
+// - Direct or PID control of the heater, optionally with load detection
 // - Temperature control via rotary encoder
 // - Boost mode by short pressing rotary encoder switch
 // - Setup menu by long pressing rotary encoder switch
@@ -13,13 +13,17 @@
 // - Time driven sleep/power off mode if iron is unused (movement detection)
 // - Measurement of input voltage, Vcc and ATmega's internal temperature
 // - Information display on OLED
-// - Buzzer
+// - Buzzer (non-blocking beep patterns)
 // - Calibrating and managing different soldering tips
-// - Storing user settings into the EEPROM
+// - PID auto-tune per tip (relay method)
+// - Step response benchmark of the heater control
+// - Storing user settings into the EEPROM (wear-levelled, CRC protected, written in the background)
 // - Tip change detection
+// - Health monitor with safe heater cut-off and hardware watchdog
 // - Can be used with either N or P channel mosfets
 // - Screen flip support
 // - Rotary encoder reverse support
+// - Binary telemetry stream and text commands for remote control over the UART
 //
 // Power supply should be in the range of 16V/2A to 24V/3A and well
 // stabilized.
@@ -49,32 +53,19 @@
 
 // Libraries
 #include <U8g2lib.h>   // https://github.com/olikraus/u8glib
-#include <PID_v1.h>    // https://github.com/wagiminator/ATmega-Soldering-Station/blob/master/software/libraries/Arduino-PID-Library.zip
-                       // (old cpp version of https://github.com/mblythe86/C-PID-Library/tree/master/PID_v1)
+#include <TwiByte.h>   // interrupt driven I2C transport for U8g2 (lib/TwiByte)
+#include <FixedPID.h>  // integer PID controller (lib/FixedPID), same algorithm as the Arduino PID library
 #include <EEPROM.h>    // for storing user settings into EEPROM
-#include <avr/sleep.h> // for sleeping during ADC sampling
+#include <avr/sleep.h> // for sleeping during ADC sampling and while idle
+#include <avr/wdt.h>   // for resetting a stalled control loop
+#include <util/crc16.h> // for checking the EEPROM records
+#include "Hardware.h"  // hardware profile with direct pin access
 
 // Firmware version
 #define VERSION "v2.0"
 
-// Type of MOSFET
-#define P_MOSFET // P_MOSFET or N_MOSFET
-
-// Type of OLED Controller
-#define SSD1306 // SSD1306 or SH1106
-
-// Type of rotary encoder
-#define ROTARY_TYPE 0 // 0: 2 increments/step; 1: 4 increments/step (default)
-
-// Pins
-#define SENSOR_PIN A0  // tip temperature sense
-#define VIN_PIN A1     // input voltage sense
-#define BUZZER_PIN 5   // buzzer
-#define BUTTON_PIN 6   // rotary encoder switch
-#define ROTARY_1_PIN 7 // rotary encoder 1
-#define ROTARY_2_PIN 8 // rotary encoder 2
-#define CONTROL_PIN 9  // heater MOSFET PWM control
-#define SWITCH_PIN 10  // handle vibration switch
+// Pins, type of MOSFET, OLED controller and rotary encoder: hardware profile selected
+// by HW_PROFILE in the build_flags (include/Hardware.h, see platformio.ini)
 
 // Default temperature control values (recommended soldering temperature: 300-380°C)
 #define TEMP_MIN 150     // min selectable temperature
@@ -89,7 +80,15 @@
 #define TEMP280 308     // temperature at ADC = 280
 #define TEMP360 390     // temperature at ADC = 360
 #define TEMPCHP 30      // chip temperature while calibration
-#define TIPMAX 8        // max number of tips
+#define TEMPZERO 21     // temperature at ADC = 0 (without cold junction compensation)
+#define CALPOINTS 3     // calibration points per tip (see CalADC; changes the EEPROM layout)
+#define CJC_ENABLE false // compensate chip temperature changes since calibration
+#define CJC_INTERVAL 10  // time between two chip temperature readings in seconds
+#define CAL_STEPS 5      // setpoints of a calibration session (2..8, from CAL_FIRST to CAL_LAST)
+#define CAL_FIRST 200    // first setpoint of a calibration session
+#define CAL_LAST 400     // last setpoint of a calibration session
+#define CAL_PRIOR 16     // weight of the old calibration in the fit in 1/256 of a point
+#define TIPMAX 28       // max number of tips (records of the tip catalogue in the EEPROM)
 #define TIPNAMELENGTH 6 // max length of tip names (including termination)
 #define TIPNAME "BC1.5" // default tip name
 
@@ -100,32 +99,208 @@
 
 // Control values
 #define TIME2SETTLE 950  // time in microseconds to allow OpAmp output to settle
-#define SMOOTHIE 0.05    // OpAmp output smooth factor (1=no smoothing; 0.05 default)
-#define PID_ENABLE false // enable PID control
+#define ADC_SAMPLES 8    // ADC samples of the tip temperature per heater off window (power of 2)
+#define ADC_FAST 4       // ADC samples per window while ramping: shorter window, more heater power
+#define ADC_HOLD 16      // ADC samples per window while holding the setpoint: less noise and ripple
+#define ADC_GAP 15       // gap to the setpoint from which the windows of a ramp are used
+#define ADC_RING 32      // number of samples averaged in the ADC ring buffer (power of 2)
+#define VIN_INTERVAL 64  // measure Vin in every n-th heater off window
+#define CHIP_SAMPLES 32  // ADC samples of a chip temperature reading (taken in the heater on time of a frame)
+#define SMOOTHIE 13      // OpAmp output smooth factor in 1/256 (256=no smoothing; 13 = 0.05 default)
+#define FILTER_TYPE 1    // tip temperature filter (0: fixed SMOOTHIE; 1: adaptive)
+#define CONTROL_TYPE 0   // control type (0: direct; 1: PID; 2: PID with load detection)
 #define BEEP_ENABLE true // enable/disable buzzer
 #define BODYFLIP false   // enable/disable screen flip
 #define ECREVERSE false  // enable/disable rotary encoder reverse
 #define MAINSCREEN 1     // type of main screen (0: big numbers; 1: more infos)
+#define FAST_BOOT true   // start heating right after reset, display and voltage survey follow
+#define POWER_SAVE 2     // MCU sleep while idle (0: never; 1: idle mode; 2: power-down in off mode too)
+#define CONTRAST_WORK 207 // display contrast while working (207: U8g2 default of the SSD1306)
+#define CONTRAST_SLEEP 16 // display contrast in sleep mode (the display is switched off in off mode)
+#define PROFILE_ENABLE true // measure the run time of the loop stages (Information screen, 'profile' on serial)
+#define SERIAL_BAUD 115200  // UART baud rate
+#define TELEMETRY_RATE 5    // telemetry frames per second on the UART (0: disabled; divider of CONTROL_RATE)
+#define SERIAL_LINE 56      // max length of a serial command line including termination
+#define SERIAL_CHUNK 16     // max received bytes parsed per loop pass
+
+// Adaptive filter values (median of the last windows, then smoothing that opens up on large deltas)
+#define FILTER_MEDIAN 5  // number of measurement windows for spike rejection (odd, up to 9)
+#define FILTER_MIN 13    // smooth factor in 1/256 for a settled reading (like SMOOTHIE)
+#define FILTER_MAX 128   // smooth factor in 1/256 for a fast changing reading
+#define FILTER_DELTA 2   // ADC delta up to which the filter stays closed
+#define FILTER_OPEN 10   // ADC delta from which the filter is fully open
+#define FILTER_GAP 30    // gap to the setpoint from which the filter is fully open
+
+#if (FILTER_MEDIAN % 2 == 0) || (FILTER_MEDIAN > 9) || (FILTER_DELTA >= FILTER_OPEN)
+#error Invalid adaptive filter values!
+#endif
+
+// Control types
+#define CONTROL_DIRECT 0 // heater fully on below setpoint
+#define CONTROL_PID 1    // PID control
+#define CONTROL_LOAD 2   // PID control with power burst on sudden heat sink
+
+// Load detection values (on the unfiltered ADC value of each measurement window)
+#define LOAD_DROP 3       // ADC drop within two windows detecting a heat sink (about 1 degree C per count)
+#define LOAD_GAP 15       // max gap to the setpoint for load detection
+#define LOAD_BURST 240    // max time of the full power burst in ms
+#define LOAD_HOLDOFF 1000 // min time between two bursts in ms
+
+// Heater model for gain scheduling and feed-forward (Hakko T12)
+#define HEATER_RES 8000 // heater resistance at 20 degrees C in milliohms
+#define HEATER_TC 6     // heater resistance increase in 1/10000 per degree C
+#define TIP_LOSS 27     // heat loss of an idle tip in mW per degree C above ambient
+#define GAIN_VIN 24000  // supply voltage in mV the PID gains are tuned for
+#define GAIN_TEMP 320   // setpoint the PID gains are tuned for
+#define GAIN_NEAR 20    // gap up to which the conservative gains are used
+#define GAIN_FAR 40     // gap from which the aggressive gains are used
+
+// Thermal model learned per tip (heat capacity and idle heat loss) for the wake-up pre-heat
+#define MODEL_CAP 120   // heat capacity of a tip not learned yet in 1/50 J per degree C
+#define MODEL_HEAT 1    // length of a full power window the heat capacity is learned from in seconds
+#define MODEL_COOL 4    // length of a heater off window the heat loss is learned from in seconds
+#define MODEL_BURST 90  // length of the wake-up burst in percent of the predicted heat-up time
+#define MODEL_MARGIN 5  // gap to the setpoint in degrees C at which the burst hands over to PID
+
+// Identification of an inserted tip by its thermal response, matched against the learned models
+#define AUTOID_ENABLE true // pre-select an inserted tip after a short heat pulse (false: always ask)
+#define AUTOID_COOL 1      // length of the heater off window of a hot tip the heat loss is taken from in seconds
+#define AUTOID_LEAD 3000   // full power time in ms before the heat capacity window (MODEL_HEAT) starts
+#define AUTOID_MATCH 15    // max deviation from the learned model of the matching tip in percent
+#define AUTOID_MARGIN 5    // min lead in percent of the matching tip over the next best one
+
+// PID auto-tune values (relay oscillation around the working temperature)
+#define TUNE_HYSTERESIS 2 // relay hysteresis in degrees C
+#define TUNE_SKIP 2       // oscillation cycles ignored until the oscillation is steady
+#define TUNE_CYCLES 3     // oscillation cycles averaged for the result
+#define TUNE_TIMEOUT 300  // auto-tune timeout in seconds
+
+// Benchmark values (scripted step responses: cold start, boost, forced cool-down, sleep)
+#define BENCH_COLD 50     // tip temperature in degrees C below which a start counts as cold
+#define BENCH_HOLD 20     // time in seconds each phase is held once the setpoint is reached
+#define BENCH_DROP 40     // temperature drop in degrees C of the forced cool-down
+#define BENCH_TIMEOUT 300 // max time in seconds to reach the setpoint of a phase
+
+// Health monitor (checked every control period; a fault switches the heater off until it is acknowledged)
+#define HEALTH_TIME 3        // time in seconds a constant heater output is checked over
+#define HEALTH_COLD 150      // temperature below which a tip at full power has to heat up
+#define HEALTH_RISE 10       // min temperature rise of a cold tip at full power over HEALTH_TIME
+#define HEALTH_DRIFT 10      // max temperature rise with the heater off over HEALTH_TIME
+#define HEALTH_VIN_MIN 12000 // min supply voltage in mV (read every VIN_INTERVAL windows, 2.56s at 25Hz)
+#define HEALTH_VIN_MAX 28000 // max supply voltage in mV
+#define HEALTH_CHIP 700      // max chip temperature in 1/10 degrees C
+#define HEALTH_MISSES 5      // max number of consecutive control periods the main loop may miss
+#define WATCHDOG_TIME WDTO_500MS // resets the MCU if no control period is served (heater pin is released)
+
+// Usage statistics of the tips (counted every control period, stored with the settings)
+#define USAGE_HOT 200  // tip temperature from which the time at temperature is counted
+#define USAGE_FLUSH 60 // max time in minutes changed counters are only held in RAM while working
+#define USAGE_TENTH (360UL * CONTROL_RATE)   // control periods per 1/10 h
+#define USAGE_WH (3600000UL * CONTROL_RATE) // mW control periods per Wh
+
+// Scheduler values
+#define CONTROL_RATE 25 // measurement and heater control rate in Hz (20..50)
+#define DISPLAY_RATE 8  // main screen refresh rate in Hz (5..10)
+#define CONTROL_PERIOD (1000 / CONTROL_RATE) // control period in scheduler ticks (ms)
+#define DISPLAY_PERIOD (1000 / DISPLAY_RATE) // display period in scheduler ticks (ms)
 
-// EEPROM identifier
+// Heater PWM frame (Timer1 at 16MHz / 256 = 62.5kHz, 16us per count); each frame starts
+// with the measurement window (heater off), followed by the heater on time until TOP
+#define FRAME_COUNTS (62500 / CONTROL_RATE)                                // counts per PWM frame
+#define SETTLE_COUNTS (TIME2SETTLE / 16)                                   // window start to first sample
+#define WINDOW_COUNTS(n) ((TIME2SETTLE + (n) * 104 + 100) / 16)         // window of n samples incl. margin
+#define HEATER_SPAN(n) (FRAME_COUNTS - WINDOW_COUNTS(n))                   // counts available for heating
+#define CHIP_SPAN (HEATER_SPAN(ADC_HOLD) * 16 / 104 - CHIP_SAMPLES - 8) // conversions left behind the longest window
+#define CHIP_SETTLE (CHIP_SPAN > 192 ? 192 : CHIP_SPAN)                   // conversions while the 1.1V reference settles
+
+#if (CONTROL_RATE < 20) || (CONTROL_RATE > 50)
+#error CONTROL_RATE must be within 20..50 Hz!
+#endif
+#if HEALTH_TIME * CONTROL_RATE > 255
+#error HEALTH_TIME must fit into 255 control periods!
+#endif
+#if (ADC_RING & (ADC_RING - 1)) || (ADC_RING > 64)
+#error ADC_RING must be a power of 2 up to 64!
+#endif
+#if (ADC_SAMPLES * 104 > TIME2SETTLE)
+#error Vin samples must fit into the settle time of the measurement window!
+#endif
+#if (64 % ADC_FAST) || (64 % ADC_SAMPLES) || (64 % ADC_HOLD) || (ADC_FAST > ADC_SAMPLES) || \
+    (ADC_SAMPLES > ADC_HOLD) || (ADC_HOLD > 16) || (ADC_HOLD > ADC_RING)
+#error ADC_FAST, ADC_SAMPLES and ADC_HOLD must be ascending powers of 2 up to 16!
+#endif
+#if (CAL_STEPS < 2) || (CAL_STEPS > 8) || (CAL_FIRST >= CAL_LAST)
+#error CAL_STEPS must be within 2..8 ascending setpoints!
+#endif
+
+// Buzzer patterns (tone generated by Timer0 PWM on OC0B = buzzer pin, about 1kHz)
+enum
+{
+  BEEP_SHORT,
+  BEEP_LONG,
+  BEEP_DOUBLE,
+  BEEP_ALARM
+};
+#define BEEP_STEPS 8 // max number of on/off times per pattern
+#define BEEP_QUEUE 4 // number of queued patterns (power of 2)
+
+// Input events of the rotary encoder and its switch, queued by the interrupts (times in ms)
+enum
+{
+  INPUT_NONE,
+  INPUT_TURN,   // encoder turned by delta increments
+  INPUT_CLICK,  // switch released after a short press
+  INPUT_DOUBLE, // second click of a double-click (follows the click of the first one)
+  INPUT_LONG    // switch held for BUTTON_LONG (sent while still pressed)
+};
+#define INPUT_QUEUE 8      // number of queued events (power of 2)
+#define BUTTON_DEBOUNCE 10 // time the switch must be stable to change its state
+#define BUTTON_DOUBLE 300  // max time from the release of a click to the next press of a double-click
+#define BUTTON_LONG 500    // press time of a long press
+#define ENCODER_FAST 50    // time between encoder steps below which the steps are doubled
+#define ENCODER_FASTER 20  // time between encoder steps below which the steps are quadrupled
+#define ENCODER_RANGE 20   // min number of steps of a value range for acceleration
+
+// Legacy EEPROM layout (fixed offsets, only read for migration)
 #define EEPROM_IDENT 0xE76C // to identify if EEPROM was written by this program
+#define LEGACY_COPIED 0xE76D // ident of a legacy layout whose tips are already in the catalogue
+#define LEGACY_TIPS 8       // number of tips in the legacy layout and in the records of version 1 and 2
+#define LEGACY_CALPOINTS 3  // calibration points per tip in the legacy layout and in the records of version 1 and 2
+#define EEPROM_GAINS (17 + LEGACY_TIPS * (TIPNAMELENGTH + 2 * (LEGACY_CALPOINTS + 1))) // tuned PID gains of all tips
 
-// MOSFET control definitions
-#if defined(P_MOSFET) // P-Channel MOSFET
+// EEPROM settings store: records of version, sequence number, payload and CRC16 in rotating slots
+#define STORE_VERSION 4 // record format version (change with StoreFields)
+#define STORE_START 0   // first slot, over the legacy layout (records of version 1 to 3 start at STORE_OLD)
+#define STORE_OLD 192   // first slot of the records of version 1 to 3, behind the legacy layout
+#define STORE_SLOTS 4   // number of slots the records rotate through
+#define STORE_HEADER 3  // version and sequence number
+#define STORE_DELAY 2000 // time in ms to batch changes before a record is written
+
+// Tip catalogue behind the store, one packed record per tip: the name characters in 6 bits
+// (ASCII 32..95), the temperature of the first calibration point in 10 bits, the rises to the
+// next points in 9 bits each and the chip temperature in 6 bits, followed by the gains, the
+// thermal model and the usage counters as raw bytes. The tips are a ring of slots starting at
+// TipBase, so an upload is staged in the free slots behind the table and committed together
+// with the settings.
+#define TIP_BITS ((TIPNAMELENGTH - 1) * 6 + 10 + (CALPOINTS - 1) * 9 + 6) // packed bits of name and calibration
+#define TIP_GAINS ((TIP_BITS + 7) / 8) // offset of the raw bytes in a record
+#define TIP_USAGE (TIP_GAINS + sizeof(TipRecord::gains) + sizeof(TipRecord::model)) // offset of the usage counters
+#define TIP_RECORD (TIP_USAGE + sizeof(TipRecord::usage))
+#define TIP_START (STORE_START + STORE_SLOTS * STORE_RECORD)
+
+// MOSFET control definitions (heater PWM values, 255 = full power)
 #define HEATER_ON 255
 #define HEATER_OFF 0
-#define HEATER_PWM 255 - Output
-#elif defined(N_MOSFET) // N-Channel MOSFET
-#define HEATER_ON 0
-#define HEATER_OFF 255
-#define HEATER_PWM Output
-#else
-#error Wrong MOSFET type!
-#endif
+#define HEATER_PWM (255 - Output)
 
-// Define the aggressive and conservative PID tuning parameters
-double aggKp = 11, aggKi = 0.5, aggKd = 1;
-double consKp = 11, consKi = 3, consKd = 5;
+// Timer1 output mode; the compare match switches the heater on, BOTTOM switches it off
+// (inverting mode if the heater is on while the pin is high, non-inverting mode otherwise)
+#define HEATER_COM (Hardware::heaterHigh ? (bit(COM1A1) | bit(COM1A0)) : bit(COM1A1))
+
+// Define the aggressive and conservative PID tuning parameters (in 1/256) at GAIN_VIN and GAIN_TEMP;
+// between GAIN_NEAR and GAIN_FAR they are blended and all gains are scaled with the heater power
+uint16_t aggKp = 11 * 256, aggKi = 256 / 2, aggKd = 1 * 256;
+uint16_t consKp = 11 * 256, consKi = 3 * 256, consKd = 5 * 256;
 
 // Default values that can be changed by the user and stored in the EEPROM
 uint16_t DefaultTemp = TEMP_DEFAULT;
@@ -135,28 +310,137 @@ uint8_t time2sleep = TIME2SLEEP;
 uint8_t time2off = TIME2OFF;
 uint8_t timeOfBoost = TIMEOFBOOST;
 uint8_t MainScrType = MAINSCREEN;
-bool PIDenable = PID_ENABLE;
+uint8_t ControlType = CONTROL_TYPE;
 bool beepEnable = BEEP_ENABLE;
 bool BodyFlip = BODYFLIP;
 bool ECReverse = ECREVERSE;
 
-// Default values for tips
-uint16_t CalTemp[TIPMAX][4] = {TEMP200, TEMP280, TEMP360, TEMPCHP};
-char TipName[TIPMAX][TIPNAMELENGTH] = {TIPNAME};
+// Usage counters of a tip (saturating)
+enum
+{
+  USE_HEATER, // heater on time at full power in 1/10 h
+  USE_ENERGY, // heater energy in Wh
+  USE_HOT,    // time at temperature (from USAGE_HOT) in 1/10 h
+  USE_BOOST,  // number of boosts
+  USE_SLEEP,  // number of sleeps
+  USE_OFF,    // number of power offs
+  USE_COUNTERS
+};
+
+// Values of a tip; only the current tip is held in RAM, all tips are in the tip catalogue
+struct TipRecord
+{
+  char name[TIPNAMELENGTH];
+  uint16_t cal[CALPOINTS + 1];  // temperatures at CalADC and chip temperature while calibration
+  uint16_t gains[3];            // auto-tuned Kp, Ki, Kd in 1/256 (Kp = 0: not tuned, conservative gains are used)
+  uint8_t model[2];             // learned heat capacity in 1/50 J/K and idle heat loss in mW/K (0: not learned)
+  uint16_t usage[USE_COUNTERS]; // counted by USAGECheck
+};
+TipRecord ActiveTip;              // current tip, stored with the settings (its catalogue record is
+                                  // only updated when another tip is selected)
 uint8_t CurrentTip = 0;
 uint8_t NumberOfTips = 1;
+uint8_t TipBase;                  // catalogue slot of the first tip
+uint8_t tipWrite[TIP_RECORD];     // record being written into the catalogue in the background
+uint16_t tipWriteAddr;
+uint8_t tipWritePos, tipWriteSize; // next byte to write and bytes of the record (equal: idle)
+
+// ADC values of the calibration points and their default temperatures (CALPOINTS entries each)
+constexpr uint16_t CalADC[CALPOINTS] = {200, 280, 360};
+constexpr uint16_t CalDefault[CALPOINTS] = {TEMP200, TEMP280, TEMP360};
+constexpr uint16_t LegacyADC[LEGACY_CALPOINTS] = {200, 280, 360}; // calibration points of the legacy layouts
+
+constexpr bool calAscending(const uint16_t *value, uint8_t count)
+{
+  return !count || (value[0] && ((count == 1) || ((value[0] < value[1]) && calAscending(value + 1, count - 1))));
+}
+static_assert(calAscending(CalADC, CALPOINTS) && calAscending(CalDefault, CALPOINTS),
+              "CalADC and CalDefault must hold CALPOINTS ascending non-zero values!");
+
+// ADC to temperature lookup table of the current tip (16 ADC counts per entry)
+#define TABLESHIFT 4
+#define TABLESIZE ((1024 >> TABLESHIFT) + 1)
+int16_t TempTable[TABLESIZE];
+int16_t tableChip; // chip temperature in degrees C the table was built for
+
+// Payload of the EEPROM settings records, stored in this order as raw bytes
+struct StoreField
+{
+  void *data;
+  uint16_t size;
+};
+constexpr StoreField StoreFields[] = {
+    {&DefaultTemp, sizeof(DefaultTemp)}, {&SleepTemp, sizeof(SleepTemp)}, {&BoostTemp, sizeof(BoostTemp)},
+    {&time2sleep, sizeof(time2sleep)}, {&time2off, sizeof(time2off)}, {&timeOfBoost, sizeof(timeOfBoost)},
+    {&MainScrType, sizeof(MainScrType)}, {&ControlType, sizeof(ControlType)}, {&beepEnable, sizeof(beepEnable)},
+    {&BodyFlip, sizeof(BodyFlip)}, {&ECReverse, sizeof(ECReverse)}, {&CurrentTip, sizeof(CurrentTip)},
+    {&NumberOfTips, sizeof(NumberOfTips)}, {&TipBase, sizeof(TipBase)}, {&ActiveTip, sizeof(ActiveTip)}};
+
+constexpr uint16_t storeSize(const StoreField *field, uint8_t count)
+{
+  return count ? field->size + storeSize(field + 1, count - 1) : 0;
+}
+#define STORE_PAYLOAD storeSize(StoreFields, sizeof(StoreFields) / sizeof(StoreFields[0]))
+#define STORE_RECORD (STORE_HEADER + STORE_PAYLOAD + 2)
+static_assert(TIP_START + TIPMAX * TIP_RECORD <= E2END + 1, "Tip catalogue exceeds the EEPROM!");
+
+// Records of version 1 and 2 (only read for migration): the settings up to NumberOfTips, followed
+// by the names, calibrations, gains and (version 2) thermal models of LEGACY_TIPS tips as arrays
+#define STORE_SETTINGS storeSize(StoreFields, sizeof(StoreFields) / sizeof(StoreFields[0]) - 2)
+#define STORE_V1_RECORD (STORE_HEADER + STORE_SETTINGS + LEGACY_TIPS * (TIPNAMELENGTH + 2 * (LEGACY_CALPOINTS + 4)) + 2)
+#define STORE_V2_RECORD (STORE_V1_RECORD + LEGACY_TIPS * 2)
+
+// The first record of a migration must not overlap the data it is migrated from: the records of
+// version 1 and 2 go into the first slot and their tips into the catalogue behind them, the
+// legacy layout into the last slot once its tips are in the catalogue
+static_assert(STORE_START + STORE_RECORD <= STORE_OLD, "First slot overlaps the old records!");
+static_assert(STORE_START + (STORE_SLOTS - 1) * STORE_RECORD >= 17, "Last slot overlaps the legacy settings!");
+static_assert(TIP_START >= EEPROM_GAINS + LEGACY_TIPS * sizeof(TipRecord::gains), "Catalogue overlaps the legacy layout!");
+static_assert(TIPMAX * TIP_RECORD >= STORE_V2_RECORD + (LEGACY_TIPS + 1) * TIP_RECORD, "Old record and tips exceed the catalogue!");
+
+// Records of version 3 (only read for migration): the payload without the usage counters of the
+// current tip, followed by a catalogue of V3_TIPS records without usage counters; they always had
+// LEGACY_CALPOINTS calibration points, so only a build with as many points migrates them
+#define V3_TIPS 40
+#define V3_TIP_RECORD TIP_USAGE
+#define V3_MIGRATE (CALPOINTS == LEGACY_CALPOINTS)
+#define STORE_V3_RECORD (STORE_RECORD - sizeof(TipRecord::usage))
+#define V3_TIP_START (STORE_OLD + STORE_SLOTS * STORE_V3_RECORD)
+static_assert(!V3_MIGRATE || (V3_TIP_START > TIP_START), "Catalogue of version 3 has to be behind the current one!");
+
+// Migration of the catalogue of version 3 (restartable, see migrateStage): a scratch record and
+// a header behind both catalogues keep the state over a reset
+#define MIGRATE_START (V3_TIP_START + V3_TIPS * V3_TIP_RECORD) // scratch record
+#define MIGRATE_SHIFT (MIGRATE_START + V3_TIP_RECORD)            // slot of the first tip in the old ring
+#define MIGRATE_STEP (MIGRATE_SHIFT + 1)                         // next step to copy
+#define MIGRATE_NONE 0xFF                                        // step value of a completed migration
+static_assert(!V3_MIGRATE || (TIP_START + TIPMAX * TIP_RECORD <= MIGRATE_START), "Migration overlaps the catalogue!");
+static_assert(!V3_MIGRATE || (MIGRATE_STEP <= E2END), "Migration header exceeds the EEPROM!");
+static_assert(2 * V3_TIPS + 2 * TIPMAX < MIGRATE_NONE, "Migration steps must fit into a byte!");
+
+// Variables for EEPROM settings store
+uint8_t storeSlot;     // slot of the newest record
+uint16_t storeSeq;     // sequence number of the newest record
+uint16_t storePos;     // next byte of the record being written
+uint16_t storeCrc;     // CRC of the record being written
+bool storePending;     // settings have changed
+bool storeWriting;     // record is being written
+uint32_t storeMillis;  // time of the last change
+uint8_t migrateShift;  // slot of the first tip in the catalogue of version 3
+uint8_t migrateStep = MIGRATE_NONE; // next step of the catalogue migration
+bool migrateStaged;    // copy of the step is being written
 
 // Menu items
 const char *SetupItems[] = {"Setup Menu", "Tip Settings", "Temp Settings",
                             "Timer Settings", "Control Type", "Main Screen",
-                            "Buzzer", "Screen Flip", "EC Reverse", "Information", "Return"};
-const char *TipItems[] = {"Tip:", "Change Tip", "Calibrate Tip",
+                            "Buzzer", "Screen Flip", "EC Reverse", "Information", "Benchmark", "Return"};
+const char *TipItems[] = {"Tip:", "Change Tip", "Calibrate Tip", "Auto Tune",
                           "Rename Tip", "Delete Tip", "Add new Tip", "Return"};
 const char *TempItems[] = {"Temp Settings", "Default Temp", "Sleep Temp",
                            "Boost Temp", "Return"};
 const char *TimerItems[] = {"Timer Settings", "Sleep Timer", "Off Timer",
                             "Boost Timer", "Return"};
-const char *ControlTypeItems[] = {"Control Type", "Direct", "PID"};
+const char *ControlTypeItems[] = {"Control Type", "Direct", "PID", "Load Detect"};
 const char *MainScreenItems[] = {"Main Screen", "Big Numbers", "More Infos"};
 const char *StoreItems[] = {"Store Settings ?", "No", "Yes"};
 const char *SureItems[] = {"Are you sure ?", "No", "Yes"};
@@ -172,182 +456,761 @@ const char *BoostTempItems[] = {"Boost Temp", "\xB0"
 const char *SleepTimerItems[] = {"Sleep Timer", "Minutes"};
 const char *OffTimerItems[] = {"Off Timer", "Minutes"};
 const char *BoostTimerItems[] = {"Boost Timer", "Seconds"};
-const char *DeleteMessage[] = {"Warning", "You cannot", "delete your", "last tip!"};
-const char *MaxTipMessage[] = {"Warning", "You reached", "maximum number", "of tips!"};
+
+// Message screens, kept in flash
+#define MESSAGE_WIDTH 15 // characters of a message line including termination
+typedef char MessageLine[MESSAGE_WIDTH];
+const MessageLine DeleteMessage[] PROGMEM = {"Warning", "You cannot", "delete your", "last tip!"};
+const MessageLine MaxTipMessage[] PROGMEM = {"Warning", "You reached", "maximum number", "of tips!"};
+const MessageLine TruncateMessage[] PROGMEM = {"Warning", "Too many tips:", "the last ones", "were removed!"};
+const MessageLine TuneFailMessage[] PROGMEM = {"Auto Tune", "failed: no", "steady", "oscillation!"};
+
+#define NUMITEMS(x) (sizeof(x) / sizeof(x[0])) // number of elements of a menu item array
+
+// UI screens; the menu screens from UI_SETUP to UI_SURE are listed in the same order as in MenuItems
+enum
+{
+  UI_MAIN,
+  UI_SETUP,
+  UI_TIP,
+  UI_TEMP,
+  UI_TIMER,
+  UI_CONTROLTYPE,
+  UI_MAINSCREEN,
+  UI_BUZZER,
+  UI_FLIP,
+  UI_ECREVERSE,
+  UI_STORE,
+  UI_TUNESTORE,
+  UI_SURE,
+  UI_INPUT,
+  UI_INFO,
+  UI_MESSAGE,
+  UI_CHANGETIP,
+  UI_CALIBRATION,
+  UI_INPUTNAME,
+  UI_AUTOTUNE,
+  UI_BENCHMARK,
+  UI_FAULT,
+  UI_NOTICE
+};
+
+const char **const MenuItems[] = {SetupItems, TipItems, TempItems, TimerItems, ControlTypeItems,
+                                  MainScreenItems, BuzzerItems, FlipItems, ECReverseItems,
+                                  StoreItems, StoreItems, SureItems};
+const uint8_t MenuSizes[] = {NUMITEMS(SetupItems), NUMITEMS(TipItems), NUMITEMS(TempItems),
+                             NUMITEMS(TimerItems), NUMITEMS(ControlTypeItems), NUMITEMS(MainScreenItems),
+                             NUMITEMS(BuzzerItems), NUMITEMS(FlipItems), NUMITEMS(ECReverseItems),
+                             NUMITEMS(StoreItems), NUMITEMS(StoreItems), NUMITEMS(SureItems)};
 
 // Variables for pin change interrupt
-volatile uint8_t a0, b0, c0, d0;
+volatile uint8_t a0, b0, d0;
 volatile bool ab0;
-volatile int count, countMin, countMax, countStep;
 volatile bool handleMoved;
 
+// Variables for input events (the switch is debounced by the scheduler tick)
+struct InputEvent
+{
+  uint8_t type;
+  int8_t delta;   // increments of a turn
+  uint8_t ticks;  // ms since the previous turn (saturated)
+};
+volatile InputEvent inputQueue[INPUT_QUEUE];
+volatile uint8_t inputHead, inputTail;
+volatile uint8_t encoderTicks = 0xFF;       // ms since the last encoder step
+volatile uint16_t buttonTicks = 0xFFFF;     // ms since the last switch state change
+volatile uint8_t buttonBounce;              // ms the switch differs from its state
+volatile bool buttonDown, buttonLong, buttonClicked, buttonSecond;
+uint8_t buttonEvent;                        // taken button event, not handled yet
+int count, countMin, countMax, countStep;   // rotary value in increments
+
 // Variables for temperature control
-uint16_t SetTemp, ShowTemp, gap, Step;
-double Input, Output, Setpoint, RawTemp, CurrentTemp, ChipTemp;
+uint16_t SetTemp, ShowTemp, gap, Step, Setpoint;
+uint16_t RawTemp;    // smoothed ADC value in 1/64
+int16_t CurrentTemp; // tip temperature in degrees C
+int16_t ChipTemp;    // chip temperature in 1/10 degrees C
+uint8_t Output;      // PID output (0: full power, 255: heater off)
 
 // Variables for voltage readings
-uint16_t Vcc, Vin;
+uint16_t Vcc = 5000, Vin = GAIN_VIN; // defaults until the first readings
+
+// Variables for scheduler (Timer2 1ms tick)
+volatile uint8_t displayTicks;
+volatile bool displayDue;
+
+// Variables for interrupt driven ADC sampling
+enum
+{
+  ADC_IDLE,   // no measurement in progress
+  ADC_VIN,    // sampling the supply voltage while the OpAmp output settles
+  ADC_SENSOR, // sampling the tip temperature
+  ADC_CHIP    // sampling the chip temperature after the tip temperature, in the heater on time
+};
+volatile uint8_t adcState = ADC_IDLE;
+volatile bool adcLock = false;   // set while blocking ADC readings are in progress
+volatile bool adcReady = false;  // new tip temperature sample published
+volatile uint8_t adcMissed;      // samples published while the previous one was not taken yet
+volatile bool vinReady = false;  // new supply voltage sample published
+volatile uint16_t adcRing[ADC_RING];
+volatile uint16_t adcSum;        // sum of all samples in the ring buffer
+volatile uint16_t adcValue;      // published ring buffer sum
+volatile uint16_t vinSum;        // sum of supply voltage samples
+volatile bool chipRequest;       // chip temperature to be sampled after the next window
+volatile bool chipReady;         // new chip temperature sample published
+volatile uint16_t chipSum;       // sum of chip temperature samples
+volatile uint16_t adcFrame;      // sum of the samples of the current window
+volatile uint16_t adcLatest;     // published sum of the last window (unfiltered)
+volatile uint8_t adcLatestSamples = ADC_SAMPLES; // number of samples in the published sum
+volatile uint8_t adcSamples = ADC_SAMPLES;       // samples of the current window
+volatile uint8_t adcNextSamples = ADC_SAMPLES;   // samples of the next window (latched at TOP like OCR1A)
+volatile uint8_t adcHead, adcCount, vinCounter;
+volatile uint8_t heaterPWM = HEATER_OFF; // heater PWM value of the next frames
+uint8_t displayDirty;     // pages of the current frame still to be sent (bit 0 = top page)
+bool displayFull = true;  // next frame has to redraw all pages
+
+// Display power states (dimmed in sleep mode, switched off in off mode)
+enum
+{
+  DISPLAY_ON,
+  DISPLAY_DIM,
+  DISPLAY_OFF
+};
+uint8_t displayPower = DISPLAY_ON; // state last sent to the display controller
+
+// Run time profiling of the loop stages (micros(), 4us resolution)
+enum
+{
+  PROF_LOOP,
+  PROF_ROTARY,
+  PROF_SLEEP,
+  PROF_SENSOR,
+  PROF_DENOISE,
+  PROF_THERMOSTAT,
+  PROF_COMPUTE,
+  PROF_SCREEN,
+  PROF_STAGES
+};
+struct ProfileStat
+{
+  uint16_t min, max; // run time in us since the last reset
+  uint32_t avg;      // moving average of the run time in 1/8 us
+};
+ProfileStat profile[PROF_STAGES];
+uint16_t loopRate, loopCount; // loop passes per second
+uint32_t profileMillis;
+
+#if PROFILE_ENABLE
+#define PROFILE(stage, call)                     \
+  do                                             \
+  {                                              \
+    uint32_t profileStart = micros();            \
+    call;                                        \
+    profileAdd(stage, micros() - profileStart);  \
+  } while (0)
+#else
+#define PROFILE(stage, call) call
+#endif
+
+// Telemetry frames: COBS encoded payload with CRC8, enclosed in 0x00 (see tools/telemetry.py)
+#define TELEMETRY_TYPE 0x01 // frame type of the control loop telemetry
+#define TELEMETRY_SIZE 20   // payload size including frame type and CRC
+#if TELEMETRY_RATE && (CONTROL_RATE % TELEMETRY_RATE)
+#error TELEMETRY_RATE must be a divider of CONTROL_RATE!
+#endif
+uint8_t telemetryTicks; // control periods since the last frame
+uint8_t telemetrySeq;   // frame counter to detect dropped frames
+bool telemetryEnable;   // frames are sent (switched on by the telemetry command, off after reset)
+
+// Serial commands: one text line per command, answered by exactly one line ("ok", "err <reason>"
+// or the requested value; listings end with "ok"), so the host waits for the answer before sending on
+//   get [<name>]            value of a setting (all settings without name)
+//   set <name> <value>      changes a setting (stored in the EEPROM except the live temperature)
+//   tips                    lists the tip table: tip <n> "<name>" <CalADC temps> <chip temp> <Kp> <Ki> <Kd>
+//   load, tip ..., commit <current tip>, abort
+//                           replaces the whole tip table in one transaction (tips in ascending order,
+//                           names of ASCII 32..95); the tips are staged in the free catalogue slots,
+//                           so up to TIPMAX minus the number of tips can be uploaded
+//   profile                 run times of the loop stages
+//   bench                   results of the last benchmark
+//   usage                   lists the usage of the tips: usage <n> "<name>" <heater on time in 1/10 h>
+//                           <energy in Wh> <time at temperature in 1/10 h> <boosts> <sleeps> <offs>
+//   telemetry on|off        starts or stops the binary telemetry frames (off after reset)
+// The telemetry frames share the UART with the answers: they are held back while a command line is
+// received or a listing is sent, and each frame is enclosed in 0x00, so the host can split both apart
+#if SERIAL_LINE >= 64
+#error SERIAL_LINE must fit into the UART TX buffer!
+#endif
+enum
+{
+  LIST_NONE,
+  LIST_SETTINGS,
+  LIST_TIPS,
+  LIST_PROFILE,
+  LIST_BENCH,
+  LIST_USAGE
+};
+
+// Start-up tasks, deferred to the main loop in fast boot
+enum
+{
+  BOOT_DISPLAY,
+  BOOT_VCC,
+  BOOT_CHIP,
+  BOOT_BEEP,
+  BOOT_DONE
+};
+uint8_t bootStep = BOOT_DISPLAY;
+
+// Variables for buzzer (patterns are alternating on and off times in ms, starting with on)
+const uint8_t BeepPatterns[][BEEP_STEPS] = {{64, 40}, {250, 40}, {64, 64, 64, 40}, {150, 100, 150, 100, 150, 100, 150, 100}};
+volatile uint8_t beepQueue[BEEP_QUEUE];
+volatile uint8_t beepHead, beepTail;
+volatile uint8_t beepPattern, beepStep = BEEP_STEPS, beepTicks;
+
+// Variables for adaptive filter
+uint16_t filterWin[FILTER_MEDIAN]; // unfiltered ADC values of the last windows in 1/64
+uint8_t filterHead;
+bool filterSettled = true; // filter is closed, reading is stable
+
+// Variables for load detection (counted in control periods)
+uint16_t loadRaw[2];  // unfiltered ADC values of the two previous windows
+uint16_t loadLevel;   // unfiltered ADC value before the drop
+uint8_t loadBurst;    // remaining burst periods
+uint8_t loadHoldoff;  // remaining periods until the next burst may start
+
+// Variables for the usage statistics (remainders below the units of the counters)
+uint32_t usageHeater; // heater PWM values summed up (255: one period at full power)
+uint32_t usageEnergy; // heater power in mW summed up
+uint16_t usageHot;    // periods at temperature
+bool usageChanged;    // counters have changed since they were last stored
+uint32_t usageMillis; // time the counters were last stored
+
+// Variables for the thermal model (counted in control periods)
+bool modelHeating;    // current window is at full power, otherwise with the heater off
+uint16_t modelTicks;  // periods of the current window (0: no window)
+int16_t modelStart;   // temperature at the start of the window
+uint16_t modelBurst;  // remaining periods of the wake-up burst
+uint8_t modelReady;   // predicted time in seconds until the setpoint is reached (0: none)
+
+// Variables for the tip identification (counted in control periods)
+enum
+{
+  IDENT_NONE,
+  IDENT_COOL, // heater off, a hot tip cools down
+  IDENT_LEAD, // full power until the heat flows into the tip
+  IDENT_HEAT  // full power, the heat capacity is measured
+};
+#define IDENT_NOTIP 0xFF
+uint8_t identState = IDENT_NONE;
+uint8_t identTicks;             // periods of the current phase
+int16_t identTemp;              // temperature at the start of the phase
+int16_t identDrop, identRise;   // drop and mean temperature above ambient of the cooling window (0: none)
+uint8_t identTip = IDENT_NOTIP; // tip identified, not selected yet
+
+// Pages of the information screen
+#define INFO_PAGES (2 + PROFILE_ENABLE)
+
+// Variables for UI state machine
+uint8_t uiScreen = UI_MAIN;
+uint8_t uiParent, uiParentSel;       // menu and item a leaf screen was opened from
+const char **uiItems;                // items of current menu or input screen
+const MessageLine *uiMessage;        // lines of the current message screen
+uint8_t uiNumberOfItems;
+uint8_t uiSelected;
+int8_t uiArrow;
+int uiLastRotary;
+uint8_t uiDigit, uiCalStep;
+uint16_t uiCalTemp[CALPOINTS + 1]; // fitted calibration of the session
+uint16_t uiCalADC[CAL_STEPS];      // ADC values of the calibration points in 1/64
+uint16_t uiCalMeasured[CAL_STEPS]; // measured temperatures of the calibration points
+int16_t uiCalChip[CAL_STEPS];      // chip temperatures of the calibration points in 1/10 degrees C
+uint16_t uiSaveSetTemp;
+bool uiTipInserted;
+uint32_t uiInfoMillis;
+
+// Variables for PID auto-tune (relay oscillation, counted in control periods)
+enum
+{
+  TUNE_RUNNING,
+  TUNE_DONE,
+  TUNE_FAILED
+};
+uint8_t tuneState;
+uint8_t tuneCycle;             // number of completed oscillation cycles
+bool tuneHeating;              // current relay state
+int16_t tuneMax, tuneMin;      // temperature peaks of the current cycle
+uint16_t tuneTicks;            // control periods since the start of the current cycle
+uint16_t tuneTotal;            // control periods since the start of the auto-tune
+uint16_t tunePeriods, tuneAmps; // sums of the averaged cycle lengths and peak-to-peak amplitudes
+uint16_t tuneGains[3];         // identified Kp, Ki, Kd in 1/256
+
+// Settings accessible by serial commands (action taken after a change)
+enum
+{
+  SET_TEMP,  // live working temperature, not stored
+  SET_STORE, // stored into the EEPROM
+  SET_FLIP,  // stored, screen flip changed
+  SET_TIP,   // stored, tip changed
+  SET_GAIN   // stored, value of the current tip
+};
+struct SerialSetting
+{
+  char name[10];
+  void *data;
+  uint8_t size; // 1 or 2 bytes
+  uint8_t action;
+  uint16_t min, max;
+};
+const SerialSetting SerialSettings[] PROGMEM = {
+    {"temp", &SetTemp, 2, SET_TEMP, TEMP_MIN, TEMP_MAX},
+    {"deftemp", &DefaultTemp, 2, SET_STORE, TEMP_MIN, TEMP_MAX},
+    {"sleeptemp", &SleepTemp, 2, SET_STORE, 20, 200},
+    {"boosttemp", &BoostTemp, 1, SET_STORE, 10, 100},
+    {"sleeptime", &time2sleep, 1, SET_STORE, 0, 30},
+    {"offtime", &time2off, 1, SET_STORE, 0, 60},
+    {"boosttime", &timeOfBoost, 1, SET_STORE, 0, 180},
+    {"screen", &MainScrType, 1, SET_STORE, 0, 1},
+    {"control", &ControlType, 1, SET_STORE, CONTROL_DIRECT, CONTROL_LOAD},
+    {"beep", &beepEnable, 1, SET_STORE, 0, 1},
+    {"flip", &BodyFlip, 1, SET_FLIP, 0, 1},
+    {"reverse", &ECReverse, 1, SET_STORE, 0, 1},
+    {"tip", &CurrentTip, 1, SET_TIP, 0, TIPMAX - 1},
+    {"kp", &ActiveTip.gains[0], 2, SET_GAIN, 0, 0xFFFF},
+    {"ki", &ActiveTip.gains[1], 2, SET_GAIN, 0, 0xFFFF},
+    {"kd", &ActiveTip.gains[2], 2, SET_GAIN, 0, 0xFFFF}};
+
+// Variables for serial commands
+uint8_t serialTipCount;       // number of tips received (staged in the catalogue)
+bool serialLoading;           // upload transaction in progress
+char serialLine[SERIAL_LINE]; // command line being received
+uint8_t serialLength;
+bool serialOverflow;          // command line too long, discarded
+uint8_t serialList;           // listing being sent, one line per pass
+uint8_t serialIndex;          // next line of the listing
+
+// Variables for benchmark (counted in control periods); the phases from BENCH_HEAT are recorded
+enum
+{
+  BENCH_COOL,  // heater off until the tip is cold
+  BENCH_HEAT,  // cold start to DefaultTemp
+  BENCH_BOOST, // step to the boost temperature
+  BENCH_LOAD,  // heater off until the tip has dropped by BENCH_DROP, then back to DefaultTemp
+  BENCH_SLEEP, // step down to SleepTemp
+  BENCH_DONE
+};
+#define BENCH_PHASES (BENCH_DONE - BENCH_HEAT)
+struct BenchResult
+{
+  uint16_t reach;    // time to reach the setpoint in 1/10 s
+  int16_t overshoot; // max deviation beyond the setpoint in degrees C
+  uint8_t ripple;    // peak-to-peak temperature in the second half of the hold time
+  uint8_t duty;      // average heater duty of the phase in percent
+};
+BenchResult benchResults[BENCH_PHASES];
+uint8_t benchPhase;
+uint8_t benchCompleted; // number of recorded phases
+uint16_t benchTarget;   // setpoint of the current phase
+bool benchRising;       // setpoint of the current phase is above the start temperature
+bool benchForced;       // heater is forced off
+uint16_t benchTicks;    // control periods since the start of the phase
+uint16_t benchReached;  // control periods until the setpoint was reached (0: not yet)
+int16_t benchMax, benchMin; // temperature peaks in the second half of the hold time
+uint32_t benchDuty;     // sum of the heater PWM values of the phase
+
+// Snapshot of the values drawn on the main screen (kept constant over all pages of a frame)
+uint16_t dispSetpoint, dispTemp, dispVin; // input voltage in 1/10 V
+uint8_t dispStatus, dispTip, dispReady;
 
 // State variables
 bool inSleepMode = false;
 bool inOffMode = false;
 bool inBoostMode = false;
 bool inCalibMode = false;
+bool inTuneMode = false;
+bool inBenchMode = false;
 bool isWorky = true;
 bool beepIfWorky = true;
 bool TipIsPresent = true;
 
+// Variables for the health monitor (counted in control periods)
+enum
+{
+  FAULT_NONE,
+  FAULT_HEATER,  // tip does not heat up at full power (heater open, sensor shorted)
+  FAULT_RUNAWAY, // tip heats up with the heater off (MOSFET stuck)
+  FAULT_VIN,     // supply voltage out of range
+  FAULT_CHIP,    // controller overheated
+  FAULT_LOOP     // control loop missed its deadlines or was reset by the watchdog
+};
+const MessageLine FaultMessages[][4] PROGMEM = {{"Fault", "Tip does not", "heat up!", "Press to reset"},
+                                                {"Fault", "Tip heats up", "heater off!", "Press to reset"},
+                                                {"Fault", "Supply voltage", "out of range!", "Press to reset"},
+                                                {"Fault", "Controller", "overheated!", "Press to reset"},
+                                                {"Fault", "Control loop", "stalled!", "Press to reset"}};
+uint8_t faultCode = FAULT_NONE;
+uint8_t healthOutput; // constant heater output of the current check (0 or 255)
+uint8_t healthTicks;  // periods of the current check (0: none)
+int16_t healthStart;  // temperature at the start of the check
+uint8_t resetFlags __attribute__((section(".noinit"))); // MCUSR at reset
+
 // Timing variables
 uint32_t sleepmillis;
 uint32_t boostmillis;
-uint32_t buttonmillis;
+uint32_t cjcMillis; // time of the last chip temperature reading
 uint8_t goneMinutes;
 uint8_t goneSeconds;
-uint8_t SensorCounter = 255;
 
 // Specify variable pointers and initial PID tuning parameters
-PID ctrl(&Input, &Output, &Setpoint, aggKp, aggKi, aggKd, REVERSE);
+FixedPID ctrl(&CurrentTemp, &Output, &Setpoint, aggKp, aggKi, aggKd, REVERSE);
 
 // Setup u8g object depending on OLED controller
-#if defined(SSD1306)
-
-U8G2_SSD1306_128X64_NONAME_1_HW_I2C u8g(U8G2_R0, 255, 5, 4); // U8G_I2C_OPT_DEV_0|U8G_I2C_OPT_NO_ACK|U8G_I2C_OPT_FAST);
-#elif defined(SH1106)
-U8GLIB_SH1106_128X64 u8g(U8G_I2C_OPT_FAST | U8G_I2C_OPT_NO_ACK);
-#else
-#error Wrong OLED controller type!
-#endif
+Hardware::Display u8g(U8G2_R0); // pages are sent by the TWI interrupt
 
 void AddTipScreen();
-void beep();
+void AutoTune();
+void AutoTuneScreen();
+void beep(uint8_t = BEEP_SHORT);
+void Benchmark();
+void BenchmarkEnd();
+void BenchmarkPhase(uint8_t);
+void BenchmarkScreen();
+void benchmarkPrint(uint8_t);
+void beepNext();
+void BOOTCheck();
+void buildTempTable();
+void buttonTick();
 void calculateTemp();
+void calLegacy(const uint16_t *);
+uint8_t cobsEncode(const uint8_t *, uint8_t, uint8_t *);
+bool calibrationFit(uint8_t);
 void CalibrationScreen();
-void ChangeTipScreen();
+void CalibrationStep();
+int16_t chipConvert(uint16_t);
+void CJCCheck();
+void ChangeTipScreen(bool);
+uint16_t adcConvert(uint8_t);
+void ADCLock();
+void ADCUnlock();
 void DeleteTipScreen();
 uint16_t denoiseAnalog(byte);
-double getChipTemp();
+void DISPLAYUpdate();
+void DrawAutoTuneScreen();
+void DrawBenchmarkScreen();
+void DrawCalibrationScreen();
+void DrawChangeTipScreen();
+void DrawInfoScreen();
+void DrawInputNameScreen();
+void DrawInputScreen();
+void DrawMessageScreen();
+void DrawScreen();
+void filterTemp();
+uint8_t getButton();
+uint32_t getHeaterPower(uint16_t, uint16_t);
+int16_t getChipTemp();
+void EEPROMCheck();
+void faultSet(uint8_t);
+void eepromRead(uint16_t, void *, uint8_t);
 void getEEPROM();
+void getLegacyEEPROM(uint8_t[][TIP_RECORD]);
+void getOldRecord(uint16_t, bool, uint8_t[][TIP_RECORD]);
+void getV3Record(uint16_t);
 int getRotary();
+uint16_t getFrameADC();
+uint16_t getTipADC();
 uint16_t getVCC();
 uint16_t getVIN();
-void InfoScreen();
+void HEALTHCheck();
+uint8_t holdPower(uint16_t);
+void IDENTCheck();
+uint8_t identMatch(uint16_t, int16_t);
+bool identStart();
+void identStop();
+void InputDone(uint16_t);
 void InputNameScreen();
-uint16_t InputScreen(const char **);
+void InputScreen(const char **);
+void INPUTCheck();
+void inputPush(uint8_t, int8_t);
+void LOADCheck();
 void MainScreen();
-uint8_t MenuScreen(const char **, uint8_t, uint8_t);
-void MessageScreen(const char **, uint8_t);
+uint8_t MainSnapshot();
+void migrateNext();
+bool migrateStage(uint8_t);
+uint16_t modelCap();
+void MODELCheck();
+uint32_t modelHeatTime(int16_t, uint16_t);
+void modelLearn(uint8_t *, int32_t);
+uint8_t modelLoss();
+void modelWake();
+void packBits(uint8_t *, uint8_t *, uint16_t, uint8_t);
+void POWERCheck();
+void printTenths(int16_t);
+void profileAdd(uint8_t, uint32_t);
+void PROFILECheck();
+void profileDump(uint8_t);
+void profileReset();
+void MenuOpen(uint8_t, uint8_t);
+void MenuScreen();
+void MenuSelect();
+void MessageScreen(const MessageLine *, uint8_t);
 void ROTARYCheck();
+uint16_t scheduleGain(uint16_t, uint16_t, uint16_t, uint16_t);
 void SENSORCheck();
+void SERIALCheck();
+void serialCommand();
+void serialCommit(char *);
+int8_t serialFind(const char *);
+void serialListNext();
+void serialLoadTip(char *);
+bool serialNumber(const char *, uint16_t *);
+void serialPrintSetting(uint8_t);
+void serialPrintTip(uint8_t);
+void serialPrintUsage(uint8_t);
+void serialSet(uint8_t, uint16_t);
+uint8_t *serialSetting(uint8_t, SerialSetting *);
+char *serialToken(char **);
 void SetFlip();
+void setHeater(uint8_t);
+void setDefaultTip();
 void setRotary(int, int, int, int);
+void SetupExit();
 void SetupScreen();
 void SLEEPCheck();
-void TempScreen();
+uint8_t *storeData(uint16_t);
+uint8_t storeNewest(uint16_t, uint8_t, uint16_t, uint16_t *);
+bool storeValid(uint16_t, uint8_t, uint16_t, uint16_t *);
+void TELEMETRYCheck();
 void Thermostat();
-void TimerScreen();
-void TipScreen();
+uint16_t tipAddr(uint8_t);
+bool tipBusy();
+uint8_t tipBehind(uint16_t);
+void tipLoad(uint8_t, TipRecord *);
+void tipPack(const TipRecord *, uint8_t *);
+void tipRead(uint8_t, TipRecord *);
+void tipSave();
+bool tipSelect(uint8_t);
+void tipStage(uint16_t, uint8_t);
+void tipUnpack(const uint8_t *, TipRecord *);
+void UIBack();
+void UIHandler();
+void UIOpen(uint8_t);
+uint16_t unpackBits(const uint8_t *, uint8_t *, uint8_t);
 void updateEEPROM();
+void USAGECheck();
+void usageCount(uint8_t);
+void usageRound();
+void usageStore();
+uint8_t windowSamples();
 
 void setup()
 {
   // set the pin modes
-  pinMode(SENSOR_PIN, INPUT);
-  pinMode(VIN_PIN, INPUT);
-  pinMode(BUZZER_PIN, OUTPUT);
-  pinMode(CONTROL_PIN, OUTPUT);
-  pinMode(ROTARY_1_PIN, INPUT_PULLUP);
-  pinMode(ROTARY_2_PIN, INPUT_PULLUP);
-  pinMode(BUTTON_PIN, INPUT_PULLUP);
-  pinMode(SWITCH_PIN, INPUT_PULLUP);
-
-  analogWrite(CONTROL_PIN, HEATER_OFF); // this shuts off the heater
-  digitalWrite(BUZZER_PIN, LOW);        // must be LOW when buzzer not in use
-beep();
+  if (Hardware::heaterHigh) // this shuts off the heater
+    Hardware::Heater::low();
+  else
+    Hardware::Heater::high();
+  Hardware::Heater::output();
+  Hardware::Buzzer::low(); // must be LOW when buzzer not in use
+  Hardware::Buzzer::output();
+  Hardware::Rotary1::pullup();
+  Hardware::Rotary2::pullup();
+  Hardware::Button::pullup();
+  Hardware::Switch::pullup();
+  OCR0B = 128;                            // 50% duty for the buzzer tone on Timer0
+
+  // setup Timer1 for heater PWM with measurement window (fast PWM mode 14, TOP = ICR1, prescaler 256);
+  // starting at TOP loads OCR1A from its buffer with the first count
+  TCCR1B = 0;
+  TCCR1A = HEATER_COM | bit(WGM11);
+  TCCR1B = bit(WGM13) | bit(WGM12);
+  ICR1 = FRAME_COUNTS - 1;
+  OCR1A = 0xFFFF; // above TOP: no compare match, heater stays off
+  OCR1B = SETTLE_COUNTS;
+  TCNT1 = FRAME_COUNTS - 1;
+  TCCR1B |= bit(CS12);
+
   // setup ADC
   ADCSRA |= bit(ADPS0) | bit(ADPS1) | bit(ADPS2); // set ADC prescaler to 128
   ADCSRA |= bit(ADIE);                            // enable ADC interrupt
   interrupts();                                   // enable global interrupts
 
-  // setup pin change interrupt for rotary encoder
-  PCMSK0 = bit(PCINT0); // Configure pin change interrupt on Pin8
-  PCICR = bit(PCIE0);   // Enable pin change interrupt
-  PCIFR = bit(PCIF0);   // Clear interrupt flag
-beep();
-  // prepare and start OLED
-  u8g.begin();
+  // setup pin change interrupt for rotary encoder and handle vibration switch
+  PCMSK0 = Hardware::Rotary2::mask | Hardware::Switch::mask; // Configure pin change interrupt
+  PCMSK2 = Hardware::Button::mask; // encoder switch, only enabled while powered down
+  PCICR = bit(PCIE0);                 // Enable pin change interrupt
+  PCIFR = bit(PCIF0);                 // Clear interrupt flag
 
   // get default values from EEPROM
   getEEPROM();
 
-  // set screen flip
-  SetFlip();
-
-  // read supply voltages in mV
-  Vcc = getVCC();
-  Vin = getVIN();
+  Serial.begin(SERIAL_BAUD);
 
-  // read and set current iron temperature
+  // read and set current iron temperature; until the voltage survey is done, the chip
+  // temperature of the calibration is assumed and Vin is taken from the first window
   SetTemp = DefaultTemp;
-  RawTemp = denoiseAnalog(SENSOR_PIN);
-  ChipTemp = getChipTemp();
+  uint16_t temp = denoiseAnalog(Hardware::sensorChannel);
+  RawTemp = temp << 6;
+  ChipTemp = ActiveTip.cal[CALPOINTS] * 10;
+  buildTempTable();
   calculateTemp();
 
+  // prefill ADC ring buffer with current reading
+  for (uint8_t i = 0; i < ADC_RING; i++)
+    adcRing[i] = temp;
+  adcSum = adcValue = temp * ADC_RING;
+  adcLatest = temp * ADC_SAMPLES;
+  loadRaw[0] = loadRaw[1] = temp << 6;
+  for (uint8_t i = 0; i < FILTER_MEDIAN; i++)
+    filterWin[i] = temp << 6;
+
   // turn on heater if iron temperature is well below setpoint
-  if ((CurrentTemp + 20) < DefaultTemp)
-    analogWrite(CONTROL_PIN, HEATER_ON);
+  if ((CurrentTemp + 20) < (int16_t)DefaultTemp)
+    setHeater(HEATER_ON);
 
-  // set PID output range and start the PID
+  // set PID output range, sample time and start the PID
   ctrl.SetOutputLimits(0, 255);
+  ctrl.SetSampleTime(CONTROL_PERIOD);
   ctrl.SetMode(AUTOMATIC);
 
   // set initial rotary encoder values
-  a0 = PINB & 1;
-  b0 = PIND >> 7 & 1;
+  a0 = Hardware::Rotary2::read();
+  b0 = Hardware::Rotary1::read();
   ab0 = (a0 == b0);
+  d0 = Hardware::Switch::read(); // handle vibration switch
   setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, DefaultTemp);
 
+  // setup Timer2 as 1ms scheduler tick (CTC mode, prescaler 64, 16MHz / 64 / 250 = 1kHz)
+  TCCR2A = bit(WGM21);
+  TCCR2B = bit(CS22);
+  OCR2A = 249;
+  TIMSK2 = bit(OCIE2A);
+
+  // start measurement windows (Timer1 overflow and compare match B interrupts)
+  TIFR1 = bit(TOV1) | bit(OCF1B);
+  TIMSK1 = bit(TOIE1) | bit(OCIE1B);
+
   // reset sleep timer
   sleepmillis = millis();
 
-  // long beep for setup completion
-  beep();
-  beep();
+#if !FAST_BOOT
+  // finish display start and voltage survey before the control loop starts
+  while (bootStep != BOOT_DONE)
+    BOOTCheck();
+#endif
+
+  // from now on every control period has to be served in time
+  wdt_enable(WATCHDOG_TIME);
+  if (resetFlags & bit(WDRF))
+    faultSet(FAULT_LOOP); // the control loop has stalled before
+}
+
+// saves and clears the reset flags before the C runtime starts, a watchdog reset leaves the
+// watchdog running with its shortest timeout otherwise
+void resetInit() __attribute__((naked, used, section(".init3")));
+void resetInit()
+{
+  resetFlags = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
 }
 
 void loop()
 {
-  ROTARYCheck(); // check rotary encoder (temp/boost setting, enter setup menu)
-  SLEEPCheck();  // check and activate/deactivate sleep modes
-  SENSORCheck(); // reads temperature and vibration switch of the iron
-  Thermostat();  // heater control
-  MainScreen();  // updates the main page on the OLED
+#if PROFILE_ENABLE
+  static uint32_t loopStart;
+  uint32_t now = micros();
+  if (loopCount++)
+    profileAdd(PROF_LOOP, now - loopStart);
+  loopStart = now;
+  PROFILECheck(); // loop rate and serial dump of the run times
+#endif
+
+  BOOTCheck();                            // finishes the start-up tasks deferred by the fast boot
+  INPUTCheck();                           // takes the queued rotary encoder and switch events
+  PROFILE(PROF_ROTARY, ROTARYCheck());    // check rotary encoder (temp/boost setting, enter setup menu)
+  PROFILE(PROF_SLEEP, SLEEPCheck());      // check and activate/deactivate sleep modes
+
+  // measurement and heater control at fixed rate, whenever a new sample is ready
+  if (adcReady)
+  {
+    adcReady = false;
+    wdt_reset();                          // the control loop is alive
+    PROFILE(PROF_SENSOR, SENSORCheck());  // reads temperature and vibration switch of the iron
+    PROFILE(PROF_THERMOSTAT, Thermostat()); // heater control
+    USAGECheck();                         // counts the heater use of the tip
+    TELEMETRYCheck();                     // sends a telemetry frame every now and then
+    CJCCheck();                           // reads the chip temperature every now and then
+  }
+
+  UIHandler();     // handles the setup menu screens
+  DISPLAYUpdate(); // updates the current screen on the OLED, one page per pass
+  SERIALCheck();   // executes commands received on the UART
+  EEPROMCheck();   // writes changed settings into the EEPROM in the background
+  POWERCheck();    // sleeps until the next interrupt if there is nothing left to do
+}
+
+// runs one of the start-up tasks per call, so the heater is controlled in between
+void BOOTCheck()
+{
+  switch (bootStep)
+  {
+  case BOOT_DISPLAY:
+    u8g.begin(); // prepare and start OLED
+    u8g.setContrast(CONTRAST_WORK);
+    SetFlip();   // set screen flip
+    break;
+  case BOOT_VCC:
+    Vcc = getVCC(); // read supply voltages in mV
+    Vin = getVIN();
+    break;
+  case BOOT_CHIP:
+    ChipTemp = getChipTemp(); // read cold junction temperature, then every CJC_INTERVAL
+    cjcMillis = millis();
+    if (CJC_ENABLE)
+      buildTempTable();
+    break;
+  case BOOT_BEEP:
+    beep(BEEP_LONG); // long beep for setup completion
+    break;
+  default:
+    return;
+  }
+  bootStep++;
 }
 
 // check rotary encoder; set temperature, toggle boost mode, enter setup menu accordingly
 void ROTARYCheck()
 {
-  // set working temperature according to rotary encoder value
-  SetTemp = getRotary();
-
-  // check rotary encoder switch
-  uint8_t c = digitalRead(BUTTON_PIN);
-  if (!c && c0)
+  if (uiScreen == UI_MAIN)
   {
-    beep();
-    buttonmillis = millis();
-    while ((!digitalRead(BUTTON_PIN)) && ((millis() - buttonmillis) < 500))
-      ;
-    if ((millis() - buttonmillis) >= 500)
-      SetupScreen();
-    else
+    // set working temperature according to rotary encoder value
+    SetTemp = getRotary();
+
+    // check rotary encoder switch: click toggles boost mode, double-click changes the tip,
+    // long press enters the setup menu
+    switch (getButton())
     {
+    case INPUT_DOUBLE:
+      beep();
+      inBoostMode = !inBoostMode; // undo the toggle and the count of the first click
+      if (!inBoostMode && (ActiveTip.usage[USE_BOOST] < 0xFFFF))
+        ActiveTip.usage[USE_BOOST]--;
+      ChangeTipScreen(true);
+      break;
+    case INPUT_CLICK:
+      beep();
       inBoostMode = !inBoostMode;
       if (inBoostMode)
+      {
         boostmillis = millis();
+        usageCount(USE_BOOST);
+      }
       handleMoved = true;
+      break;
+    case INPUT_LONG:
+      SetupScreen();
+      break;
     }
   }
-  c0 = c;
 
   // check timer when in boost mode
   if (inBoostMode && timeOfBoost)
@@ -369,8 +1232,12 @@ void SLEEPCheck()
   { // if handle was moved
     if (inSleepMode)
     {                                        // in sleep or off mode?
-      if ((CurrentTemp + 20) < SetTemp)      // if temp is well below setpoint
-        analogWrite(CONTROL_PIN, HEATER_ON); // then start the heater right now
+      if (((CurrentTemp + 20) < (int16_t)SetTemp) && !faultCode) // if temp is well below setpoint
+      {
+        setHeater(HEATER_ON);                // then start the heater right now
+        if ((ControlType != CONTROL_DIRECT) && !inTuneMode)
+          modelWake();                       // and keep it on for the predicted heat-up time
+      }
       beep();                                // beep on wake-up
       beepIfWorky = true;                    // beep again when working temperature is reached
     }
@@ -386,43 +1253,42 @@ void SLEEPCheck()
   {
     inSleepMode = true;
     beep();
+    usageCount(USE_SLEEP);
+    usageStore(); // stores the thermal model learned and the usage counted while working
   }
   if ((!inOffMode) && (time2off > 0) && (goneMinutes >= time2off))
   {
     inOffMode = true;
     beep();
+    usageCount(USE_OFF);
+    usageStore();
   }
 }
 
-// reads temperature, vibration switch and supply voltages
+// processes the samples published by the ADC interrupt
 void SENSORCheck()
 {
-  analogWrite(CONTROL_PIN, HEATER_OFF); // shut off heater in order to measure temperature
-  delayMicroseconds(TIME2SETTLE);       // wait for voltage to settle
-
-  double temp = denoiseAnalog(SENSOR_PIN); // read ADC value for temperature
-  uint8_t d = digitalRead(SWITCH_PIN);     // check handle vibration switch
-  if (d != d0)
-  {
-    handleMoved = true;
-    d0 = d;
-  } // set flag if handle was moved
-  if (!SensorCounter--)
-    Vin = getVIN(); // get Vin every now and then
-
-  analogWrite(CONTROL_PIN, HEATER_PWM); // turn on again heater
+  if (vinReady)
+  { // Vin is sampled every now and then
+    vinReady = false;
+    Vin = (uint32_t)vinSum * Vcc / ADC_SAMPLES * 100 / 17947; // 179.47 = 1023 * R13 / (R12 + R13)
+  }
 
-  RawTemp += (temp - RawTemp) * SMOOTHIE; // stabilize ADC temperature reading
-  calculateTemp();                        // calculate real temperature value
+#if FILTER_TYPE
+  filterTemp(); // adaptive filter of the unfiltered ADC readings
+#else
+  RawTemp += ((int32_t)getTipADC() - RawTemp) * SMOOTHIE / 256; // stabilize averaged ADC reading
+#endif
+  calculateTemp(); // calculate real temperature value
 
-  // stabilize displayed temperature when around setpoint
-  if ((ShowTemp != Setpoint) || (abs(ShowTemp - CurrentTemp) > 5))
+  // stabilize displayed temperature when around setpoint and the reading is settled
+  if ((ShowTemp != Setpoint) || !filterSettled || (abs((int16_t)ShowTemp - CurrentTemp) > 5))
     ShowTemp = CurrentTemp;
-  if (abs(ShowTemp - Setpoint) <= 1)
+  if (abs((int16_t)ShowTemp - (int16_t)Setpoint) <= 1)
     ShowTemp = Setpoint;
 
   // set state variable if temperature is in working range; beep if working temperature was just reached
-  gap = abs(SetTemp - CurrentTemp);
+  gap = abs((int16_t)SetTemp - CurrentTemp);
   if (gap < 5)
   {
     if (!isWorky && beepIfWorky)
@@ -435,35 +1301,138 @@ void SENSORCheck()
 
   // checks if tip is present or currently inserted
   if (ShowTemp > 500)
-    TipIsPresent = false; // tip removed ?
-  if (!TipIsPresent && (ShowTemp < 500))
-  {                                                    // new tip inserted ?
-    analogWrite(CONTROL_PIN, HEATER_OFF);              // shut off heater
-    beep();                                            // beep for info
-    TipIsPresent = true;                               // tip is present now
-    ChangeTipScreen();                                 // show tip selection screen
-    updateEEPROM();                                    // update setting in EEPROM
-    handleMoved = true;                                // reset all timers
-    RawTemp = denoiseAnalog(SENSOR_PIN);               // restart temp smooth algorithm
-    c0 = LOW;                                          // switch must be released
-    setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, SetTemp); // reset rotary encoder
-  }
-}
-
-// calculates real temperature value according to ADC reading and calibration values
+  {                           // tip removed ?
+    TipIsPresent = false;
+    identStop();              // stop identifying it
+  }
+  if (!TipIsPresent && (ShowTemp < 500) && (uiScreen == UI_MAIN))
+  {                         // new tip inserted ?
+    beep();                 // beep for info
+    TipIsPresent = true;    // tip is present now
+#if FILTER_TYPE
+    for (uint8_t i = 0; i < FILTER_MEDIAN; i++)
+      filterWin[i] = getFrameADC(); // forget the readings of the open input
+    RawTemp = filterWin[0];
+    calculateTemp();
+#endif
+    ChangeTipScreen(true);  // show tip selection screen
+    if (AUTOID_ENABLE)
+      identStart();         // which the identified tip is selected on
+  }
+}
+
+// adaptive filter: the median of the last windows rejects spikes, the following smoothing
+// opens up on large deltas and far from the setpoint and closes on a stable reading
+void filterTemp()
+{
+  filterWin[filterHead] = getFrameADC();
+  if (++filterHead >= FILTER_MEDIAN)
+    filterHead = 0;
+
+  // median by insertion sort of a copy
+  uint16_t sorted[FILTER_MEDIAN];
+  for (uint8_t i = 0; i < FILTER_MEDIAN; i++)
+  {
+    uint16_t value = filterWin[i];
+    uint8_t j = i;
+    for (; j && (sorted[j - 1] > value); j--)
+      sorted[j] = sorted[j - 1];
+    sorted[j] = value;
+  }
+  int16_t delta = sorted[FILTER_MEDIAN / 2] - RawTemp;
+
+  // smooth factor from the delta (in 1/64 ADC counts) and the gap to the setpoint
+  uint16_t absDelta = abs(delta);
+  uint16_t factor = FILTER_MIN;
+  if (gap >= FILTER_GAP || absDelta >= FILTER_OPEN * 64)
+    factor = FILTER_MAX;
+  else if (absDelta > FILTER_DELTA * 64)
+    factor += (uint32_t)(FILTER_MAX - FILTER_MIN) * (absDelta - FILTER_DELTA * 64) / ((FILTER_OPEN - FILTER_DELTA) * 64);
+  filterSettled = (factor == FILTER_MIN);
+
+  RawTemp += (int32_t)delta * factor / 256;
+}
+
+// calculates real temperature value according to ADC reading using the lookup table
 void calculateTemp()
 {
-  if (RawTemp < 200)
-    CurrentTemp = map(RawTemp, 0, 200, 21, CalTemp[CurrentTip][0]);
-  else if (RawTemp < 280)
-    CurrentTemp = map(RawTemp, 200, 280, CalTemp[CurrentTip][0], CalTemp[CurrentTip][1]);
-  else
-    CurrentTemp = map(RawTemp, 280, 360, CalTemp[CurrentTip][1], CalTemp[CurrentTip][2]);
+  uint8_t index = RawTemp >> (TABLESHIFT + 6);
+  uint16_t fraction = RawTemp & ((1 << (TABLESHIFT + 6)) - 1);
+  int16_t base = TempTable[index];
+  CurrentTemp = base + (((int32_t)(TempTable[index + 1] - base) * fraction) >> (TABLESHIFT + 6));
+}
+
+// builds the lookup table of the current tip by linear interpolation between the
+// calibration points; below the first point the curve starts at ADC = 0 with the
+// ambient (or calibration chip) temperature, above the last point the last segment is
+// extrapolated; has to be called whenever the current tip or its calibration changes
+void buildTempTable()
+{
+  uint16_t *cal = ActiveTip.cal;
+  int16_t zero = TEMPZERO;
+  int16_t offset = 0;
+  tableChip = (ChipTemp + 5) / 10;
+  if (CJC_ENABLE)
+  {
+    zero = cal[CALPOINTS];                 // tip at cold junction temperature
+    offset = tableChip - cal[CALPOINTS];    // chip warmed up since calibration
+  }
+
+  uint8_t segment = 0;
+  for (uint8_t i = 0; i < TABLESIZE; i++)
+  {
+    uint16_t adc = (uint16_t)i << TABLESHIFT;
+    while ((segment < CALPOINTS - 1) && (adc >= CalADC[segment]))
+      segment++;
+    int16_t x0 = segment ? CalADC[segment - 1] : 0;
+    int16_t y0 = segment ? cal[segment - 1] : zero;
+    TempTable[i] = map(adc, x0, CalADC[segment], y0, cal[segment]) + offset;
+  }
+}
+
+// requests a chip temperature reading every CJC_INTERVAL seconds and takes the published one; the
+// ADC interrupt samples it in the heater on time behind a measurement window, so the frames keep
+// their timing. With CJC_ENABLE, the lookup table follows the cold junction, so the conversion of
+// the readings stays the same.
+void CJCCheck()
+{
+  if (chipReady)
+  {
+    chipReady = false;
+    ChipTemp = chipConvert(chipSum);
+    if (CJC_ENABLE && ((ChipTemp + 5) / 10 != tableChip))
+      buildTempTable();
+  }
+  if ((bootStep != BOOT_DONE) || (millis() - cjcMillis < CJC_INTERVAL * 1000UL))
+    return;
+  cjcMillis = millis();
+  chipRequest = true;
+}
+
+// sets the current tip to the default name and calibration values, without tuned gains and thermal model
+void setDefaultTip()
+{
+  memset(&ActiveTip, 0, sizeof(ActiveTip));
+  strcpy_P(ActiveTip.name, PSTR(TIPNAME));
+  for (uint8_t i = 0; i < CALPOINTS; i++)
+    ActiveTip.cal[i] = CalDefault[i];
+  ActiveTip.cal[CALPOINTS] = TEMPCHP;
 }
 
 // controls the heater
 void Thermostat()
 {
+  HEALTHCheck(); // keeps the heater off after a fault
+  if (faultCode)
+  {
+    Output = 255;
+    setHeater(HEATER_OFF);
+    return;
+  }
+
+  if (inBenchMode)
+    Benchmark(); // sets the working mode of the current benchmark phase
+
   // define Setpoint acoording to current working mode
   if (inOffMode)
     Setpoint = 0;
@@ -473,776 +1442,3111 @@ void Thermostat()
     Setpoint = SetTemp + BoostTemp;
   else
     Setpoint = SetTemp;
+  MODELCheck(); // learns from the heater output of the last period
 
-  // control the heater (PID or direct)
-  gap = abs(Setpoint - CurrentTemp);
-  if (PIDenable)
+  // control the heater (wake-up burst, PID or direct)
+  gap = abs((int16_t)Setpoint - CurrentTemp);
+  if (inTuneMode)
+    AutoTune();
+  else if (identState)
+    IDENTCheck();
+  else if (modelBurst)
+  {
+    // full power until the predicted time is nearly over or the setpoint is close, then
+    // hand over to the PID with the integrator pre-loaded to the power holding the setpoint
+    if (--modelBurst && TipIsPresent && (CurrentTemp < (int16_t)Setpoint - MODEL_MARGIN))
+      Output = 0;
+    else
+    {
+      modelBurst = 0;
+      uint8_t hold = holdPower(Setpoint);
+      ctrl.SetFeedForward(hold);
+      Output = 255 - hold;
+      ctrl.SetMode(AUTOMATIC);
+    }
+  }
+  else if (ControlType != CONTROL_DIRECT)
   {
-    Input = CurrentTemp;
-    if (gap < 30)
-      ctrl.SetTunings(consKp, consKi, consKd);
+    // heater power decides the plant gain: scale the gains to the power they were tuned for
+    // and feed forward the power needed to hold the setpoint against the heat loss
+    uint32_t power = max(getHeaterPower(Vin, Setpoint), 1UL);
+    uint16_t scale = constrain(getHeaterPower(GAIN_VIN, GAIN_TEMP) * 256 / power, 64, 1024);
+    uint16_t blend = constrain(((int16_t)gap - GAIN_NEAR) * 256 / (GAIN_FAR - GAIN_NEAR), 0, 256);
+    uint16_t *tuned = ActiveTip.gains;
+    if (tuned[0])
+      ctrl.SetTunings(scheduleGain(tuned[0], aggKp, blend, scale), scheduleGain(tuned[1], aggKi, blend, scale),
+                      scheduleGain(tuned[2], aggKd, blend, scale));
     else
-      ctrl.SetTunings(aggKp, aggKi, aggKd);
-    ctrl.Compute();
+      ctrl.SetTunings(scheduleGain(consKp, aggKp, blend, scale), scheduleGain(consKi, aggKi, blend, scale),
+                      scheduleGain(consKd, aggKd, blend, scale));
+    ctrl.SetFeedForward(holdPower(Setpoint));
+    PROFILE(PROF_COMPUTE, ctrl.Compute());
+    if (ControlType == CONTROL_LOAD)
+      LOADCheck();
   }
   else
   {
     // turn on heater if current temperature is below setpoint
-    if ((CurrentTemp + 0.5) < Setpoint)
+    if (CurrentTemp < (int16_t)Setpoint)
       Output = 0;
     else
       Output = 255;
   }
-  analogWrite(CONTROL_PIN, HEATER_PWM); // set heater PWM
+  if (benchForced)
+    Output = 255;        // cool-down of the benchmark
+  setHeater(HEATER_PWM); // set heater PWM
 }
 
-// creates a short beep on the buzzer
-void beep()
+// checks the plausibility of the heater, the supply and the control loop; the heating rate is
+// checked over HEALTH_TIME of constant full or zero output, where a cold tip has to heat up or
+// the tip must not heat up at all
+void HEALTHCheck()
 {
-  if (beepEnable)
+  if (faultCode)
+    return;
+  if ((bootStep == BOOT_DONE) && (adcMissed >= HEALTH_MISSES))
+    faultSet(FAULT_LOOP);
+  else if ((Vin < HEALTH_VIN_MIN) || (Vin > HEALTH_VIN_MAX))
+    faultSet(FAULT_VIN);
+  else if (ChipTemp > HEALTH_CHIP)
+    faultSet(FAULT_CHIP);
+  else if (!TipIsPresent || ((Output != 0) && (Output != 255)) || (Output != healthOutput) || !healthTicks)
   {
-    for (uint8_t i = 0; i < 255; i++)
-    {
-      digitalWrite(BUZZER_PIN, HIGH);
-      delayMicroseconds(125);
-      digitalWrite(BUZZER_PIN, LOW);
-      delayMicroseconds(125);
-    }
+    healthOutput = Output; // (re)start the check
+    healthStart = CurrentTemp;
+    healthTicks = 1;
+  }
+  else if (++healthTicks > HEALTH_TIME * CONTROL_RATE)
+  {
+    int16_t rise = CurrentTemp - healthStart;
+    if ((healthOutput == 0) && (healthStart < HEALTH_COLD) && (rise < HEALTH_RISE))
+      faultSet(FAULT_HEATER);
+    else if ((healthOutput == 255) && (rise > HEALTH_DRIFT))
+      faultSet(FAULT_RUNAWAY);
+    healthTicks = 0;
   }
 }
 
-// sets start values for rotary encoder
-void setRotary(int rmin, int rmax, int rstep, int rvalue)
+// latches a fault: switches the heater off, stops the special working modes and shows the fault
+// until it is acknowledged
+void faultSet(uint8_t code)
 {
-  countMin = rmin << ROTARY_TYPE;
-  countMax = rmax << ROTARY_TYPE;
-  countStep = ECReverse ? -rstep : rstep;
-  count = rvalue << ROTARY_TYPE;
+  identStop();
+  faultCode = code;
+  Output = 255;
+  setHeater(HEATER_OFF);
+  ctrl.SetMode(MANUAL);
+  inTuneMode = false;
+  inCalibMode = false;
+  inBenchMode = false;
+  benchForced = false;
+  modelBurst = 0;
+  loadBurst = 0;
+  if ((uiScreen != UI_MAIN) && (uiScreen != UI_NOTICE) && !((uiScreen == UI_CHANGETIP) && uiTipInserted))
+    SetTemp = uiSaveSetTemp; // leave the setup menu
+  beep(BEEP_ALARM);
+  uiMessage = FaultMessages[code - 1];
+  uiNumberOfItems = NUMITEMS(FaultMessages[0]);
+  UIOpen(UI_FAULT);
 }
 
-// reads current rotary encoder value
-int getRotary()
+// detects a sudden heat sink on the unfiltered ADC value long before the smoothed temperature
+// shows it and overrides the PID with a bounded full power burst; the PID keeps running
+// on the smoothed temperature, so it takes over again without a bump
+void LOADCheck()
 {
-  return (count >> ROTARY_TYPE);
+  uint16_t raw = getFrameADC();
+  uint16_t past = loadRaw[1];
+  loadRaw[1] = loadRaw[0];
+  loadRaw[0] = raw;
+
+  if (loadBurst)
+  {
+    loadBurst--;
+    if ((raw >= loadLevel) || (CurrentTemp >= (int16_t)Setpoint))
+      loadBurst = 0; // tip has recovered
+    else
+      Output = 0;
+  }
+  else if (loadHoldoff)
+    loadHoldoff--;
+  else if ((gap < LOAD_GAP) && (Setpoint > SleepTemp) && ((int16_t)(past - raw) >= LOAD_DROP * 64))
+  {
+    loadLevel = past;
+    loadBurst = LOAD_BURST / CONTROL_PERIOD - 1;
+    loadHoldoff = LOAD_HOLDOFF / CONTROL_PERIOD;
+    Output = 0;
+  }
 }
 
-// reads user settings from EEPROM; if EEPROM values are invalid, write defaults
-void getEEPROM()
+// learns the thermal model of the current tip from windows with the heater at full power (heat
+// capacity) or off (idle heat loss) and predicts the time until the setpoint is reached
+void MODELCheck()
 {
-  uint16_t identifier = (EEPROM.read(0) << 8) | EEPROM.read(1);
-  if (identifier == EEPROM_IDENT)
-  {
-    DefaultTemp = (EEPROM.read(2) << 8) | EEPROM.read(3);
-    SleepTemp = (EEPROM.read(4) << 8) | EEPROM.read(5);
-    BoostTemp = EEPROM.read(6);
-    time2sleep = EEPROM.read(7);
-    time2off = EEPROM.read(8);
-    timeOfBoost = EEPROM.read(9);
-    MainScrType = EEPROM.read(10);
-    PIDenable = EEPROM.read(11);
-    beepEnable = EEPROM.read(12);
-    BodyFlip = EEPROM.read(13);
-    ECReverse = EEPROM.read(14);
-    CurrentTip = EEPROM.read(15);
-    NumberOfTips = EEPROM.read(16);
-
-    uint8_t i, j;
-    uint16_t counter = 17;
-    for (i = 0; i < NumberOfTips; i++)
+  bool heating = (Output == 0);
+  if (!TipIsPresent || inCalibMode || loadBurst || (uiScreen == UI_CHANGETIP) || (!heating && (Output != 255)) ||
+      (modelTicks && (heating != modelHeating)))
+    modelTicks = 0; // no constant heater output or a heat sink, restart with the next period
+  else if (!modelTicks)
+  {
+    modelHeating = heating;
+    modelStart = CurrentTemp;
+    modelTicks = 1;
+  }
+  else if (++modelTicks > (heating ? MODEL_HEAT : MODEL_COOL) * CONTROL_RATE)
+  {
+    int16_t change = CurrentTemp - modelStart;
+    int16_t mean = (CurrentTemp + modelStart) / 2;
+    int16_t rise = mean - (ChipTemp + 5) / 10;
+    if (heating && (change >= 5))
     {
-      for (j = 0; j < TIPNAMELENGTH; j++)
-      {
-        TipName[i][j] = EEPROM.read(counter++);
-      }
-      for (j = 0; j < 4; j++)
-      {
-        CalTemp[i][j] = EEPROM.read(counter++) << 8;
-        CalTemp[i][j] |= EEPROM.read(counter++);
-      }
+      // energy in mJ into the tip over the window: heater power minus the loss at the mean temperature
+      int32_t net = (int32_t)getHeaterPower(Vin, mean) - (int32_t)modelLoss() * rise;
+      if (net > 0)
+        modelLearn(&ActiveTip.model[0], net * MODEL_HEAT / change / 20);
     }
+    else if (!heating && (change <= -2) && (rise >= 50))
+      modelLearn(&ActiveTip.model[1], (int32_t)modelCap() * -change / MODEL_COOL / rise);
+    modelStart = CurrentTemp; // next window starts right away
+    modelTicks = 1;
   }
+
+  if (!inOffMode && ((int16_t)Setpoint > CurrentTemp + 5))
+    modelReady = min(modelHeatTime(CurrentTemp, Setpoint) / 1000 + 1, 99UL);
   else
+    modelReady = 0;
+}
+
+// averages a new sample into a model value (1/4 weight, the first sample is taken as is)
+void modelLearn(uint8_t *value, int32_t sample)
+{
+  uint8_t learned = constrain(sample, 1, 255);
+  if (*value)
+    learned = ((uint16_t)*value * 3 + learned + 2) / 4;
+  *value = learned;
+}
+
+// heat capacity of the current tip in mJ per degree C
+uint16_t modelCap()
+{
+  return (ActiveTip.model[0] ? ActiveTip.model[0] : MODEL_CAP) * 20;
+}
+
+// idle heat loss of the current tip in mW per degree C above ambient
+uint8_t modelLoss()
+{
+  return ActiveTip.model[1] ? ActiveTip.model[1] : TIP_LOSS;
+}
+
+// predicted time in ms to heat the current tip at full power from the given temperature to the setpoint
+uint32_t modelHeatTime(int16_t from, uint16_t to)
+{
+  int16_t mean = (from + (int16_t)to) / 2;
+  int32_t net = (int32_t)getHeaterPower(Vin, mean) - (int32_t)modelLoss() * (mean - (ChipTemp + 5) / 10);
+  if (net <= 0)
+    return UINT32_MAX; // setpoint can't be reached
+  return (uint32_t)modelCap() * ((int16_t)to - from) * 1000 / net;
+}
+
+// heater value (0..255 of full power) holding the given temperature against the idle heat loss
+uint8_t holdPower(uint16_t temp)
+{
+  int16_t rise = (int16_t)temp - (ChipTemp + 5) / 10;
+  if (rise <= 0)
+    return 0;
+  uint32_t power = max(getHeaterPower(Vin, temp), 1UL);
+  return min((uint32_t)rise * modelLoss() * 255 / power, 255UL);
+}
+
+// starts the wake-up burst for the time the model predicts to heat up to the working temperature
+void modelWake()
+{
+  modelBurst = min(modelHeatTime(CurrentTemp, SetTemp) / CONTROL_PERIOD, 0xFFFFUL) * MODEL_BURST / 100;
+  if (modelBurst)
   {
-    EEPROM.update(0, EEPROM_IDENT >> 8);
-    EEPROM.update(1, EEPROM_IDENT & 0xFF);
-    updateEEPROM();
+    ctrl.SetMode(MANUAL); // handed over bumpless at the end of the burst
+    Output = 0;
   }
 }
 
-// writes user settings to EEPROM using updade function to minimize write cycles
-void updateEEPROM()
+// starts identifying an inserted tip: a hot tip cools down for a short window, then a pulse at
+// full power heats it up; returns false if there is nothing to choose from or no room to heat
+bool identStart()
 {
-  EEPROM.update(2, DefaultTemp >> 8);
-  EEPROM.update(3, DefaultTemp & 0xFF);
-  EEPROM.update(4, SleepTemp >> 8);
-  EEPROM.update(5, SleepTemp & 0xFF);
-  EEPROM.update(6, BoostTemp);
-  EEPROM.update(7, time2sleep);
-  EEPROM.update(8, time2off);
-  EEPROM.update(9, timeOfBoost);
-  EEPROM.update(10, MainScrType);
-  EEPROM.update(11, PIDenable);
-  EEPROM.update(12, beepEnable);
-  EEPROM.update(13, BodyFlip);
-  EEPROM.update(14, ECReverse);
-  EEPROM.update(15, CurrentTip);
-  EEPROM.update(16, NumberOfTips);
+  if ((NumberOfTips < 2) || inTuneMode || inCalibMode || inBenchMode || inSleepMode || inOffMode ||
+      (CurrentTemp + 2 * MODEL_MARGIN >= (int16_t)Setpoint))
+    return false;
+  identTemp = CurrentTemp;
+  identTicks = 0;
+  identDrop = identRise = 0;
+  identTip = IDENT_NOTIP;
+  identState = (CurrentTemp - (ChipTemp + 5) / 10 >= 50) ? IDENT_COOL : IDENT_LEAD;
+  ctrl.SetMode(MANUAL); // handed over bumpless at the end of the pulse
+  return true;
+}
 
-  uint8_t i, j;
-  uint16_t counter = 17;
-  for (i = 0; i < NumberOfTips; i++)
+// runs the heater for the phases of the tip identification, one call per control period; the
+// heat capacity window is as long as the one the models are learned from, so they compare
+void IDENTCheck()
+{
+  bool reached = (CurrentTemp >= (int16_t)Setpoint - MODEL_MARGIN);
+  identTicks++;
+  switch (identState)
   {
-    for (j = 0; j < TIPNAMELENGTH; j++)
-      EEPROM.update(counter++, TipName[i][j]);
-    for (j = 0; j < 4; j++)
+  case IDENT_COOL:
+    Output = 255;
+    if (identTicks < AUTOID_COOL * CONTROL_RATE)
+      return;
+    identDrop = identTemp - CurrentTemp;
+    identRise = (identTemp + CurrentTemp) / 2 - (ChipTemp + 5) / 10;
+    break;
+  case IDENT_LEAD:
+    Output = 0;
+    if (reached)
     {
-      EEPROM.update(counter++, CalTemp[i][j] >> 8);
-      EEPROM.update(counter++, CalTemp[i][j] & 0xFF);
+      identStop(); // no room left to measure, the tip is selected by hand
+      return;
     }
+    if (identTicks < AUTOID_LEAD / CONTROL_PERIOD)
+      return;
+    break;
+  default:
+    Output = 0;
+    if (!reached && (identTicks < MODEL_HEAT * CONTROL_RATE))
+      return;
+    identTip = identMatch(identTicks, CurrentTemp - identTemp); // selected by the UI
+    identStop();
+    return;
   }
+  identState++; // next phase
+  identTemp = CurrentTemp;
+  identTicks = 0;
 }
 
-// check state and flip screen
-void SetFlip()
+// ends the tip identification, the PID takes over at the power holding the setpoint
+void identStop()
 {
+  if (!identState)
+    return;
+  identState = IDENT_NONE;
+  uint8_t hold = holdPower(Setpoint);
+  ctrl.SetFeedForward(hold);
+  Output = 255 - hold;
+  ctrl.SetMode(AUTOMATIC);
 }
 
-// draws the main screen
-void MainScreen()
+// returns the tip whose learned model matches the heat capacity measured from the temperature
+// change over the given periods at full power (and the heat loss of the cooling window) clearly
+// best, or IDENT_NOTIP
+uint8_t identMatch(uint16_t ticks, int16_t change)
 {
-  u8g.firstPage();
-  do
-  {
-    // draw setpoint temperature
-    u8g.setFont(u8g_font_9x15);
-    u8g.setFontPosTop();
-    u8g.drawStr(0, 0, "SET:");
-    u8g.setCursor(40, 0);
-    u8g.print(Setpoint, 0);
-
-    // draw status of heater
-    u8g.setCursor(83, 0);
-    if (ShowTemp > 500)
-      u8g.print(F("ERROR"));
-    else if (inOffMode)
-      u8g.print(F("  OFF"));
-    else if (inSleepMode)
-      u8g.print(F("SLEEP"));
-    else if (inBoostMode)
-      u8g.print(F("BOOST"));
-    else if (isWorky)
-      u8g.print(F("WORKY"));
-    else if (Output < 180)
-      u8g.print(F(" HEAT"));
-    else
-      u8g.print(F(" HOLD"));
+  if (change < 5)
+    return IDENT_NOTIP;
+  int16_t mean = identTemp + change / 2;
+  int32_t net = (int32_t)getHeaterPower(Vin, mean) - (int32_t)TIP_LOSS * (mean - (ChipTemp + 5) / 10);
+  if (net <= 0)
+    return IDENT_NOTIP;
+  uint16_t cap = net * ticks / CONTROL_RATE / change / 20; // in 1/50 J per degree C like the models
+  uint16_t loss = 0;
+  if ((identDrop >= 2) && (identRise >= 50))
+    loss = (uint32_t)cap * 20 * identDrop / AUTOID_COOL / identRise;
 
-    // rest depending on main screen type
-    if (MainScrType)
-    {
-      // draw current tip and input voltage
-      float fVin = (float)Vin / 1000; // convert mv in V
-      u8g.setCursor(0, 52);
-      u8g.print(TipName[CurrentTip]);
-      u8g.setCursor(83, 52);
-      u8g.print(fVin, 1);
-      u8g.print(F("V"));
-      // draw current temperature
-      u8g.setFont(u8g2_font_freedoomr25_tn);
-      u8g.setFontPosTop();
-      u8g.setCursor(37, 22);
-      if (ShowTemp > 500)
-        u8g.print(F("000"));
-      else
-        u8g.print(ShowTemp);
-    }
+  uint8_t best = IDENT_NOTIP;
+  uint16_t bestDev = 0xFFFF, nextDev = 0xFFFF;
+  for (uint8_t i = 0; i < NumberOfTips; i++)
+  {
+    uint8_t model[2];
+    if (i == CurrentTip)
+      memcpy(model, ActiveTip.model, sizeof(model));
     else
+      eepromRead(tipAddr(i) + TIP_GAINS + sizeof(ActiveTip.gains), model, sizeof(model));
+    if (!model[0])
+      continue; // not learned yet
+    uint16_t dev = (uint32_t)abs((int16_t)cap - model[0]) * 100 / model[0];
+    if (loss && model[1])
+      dev = (dev + (uint32_t)abs((int16_t)loss - model[1]) * 100 / model[1]) / 2;
+    if (dev < bestDev)
     {
-      // draw current temperature in big figures
-      u8g.setFont(u8g2_font_fub42_tn);
-      u8g.setFontPosTop();
-      u8g.setCursor(15, 20);
-      if (ShowTemp > 500)
-        u8g.print(F("000"));
-      else
-        u8g.print(ShowTemp);
+      nextDev = bestDev;
+      bestDev = dev;
+      best = i;
     }
-  } while (u8g.nextPage());
+    else if (dev < nextDev)
+      nextDev = dev;
+  }
+  if ((bestDev > AUTOID_MATCH) || (nextDev < bestDev + AUTOID_MARGIN))
+    return IDENT_NOTIP;
+  return best;
 }
 
-// setup screen
+// maximum heater power in mW at the given supply voltage in mV and tip temperature,
+// taking the measurement window into account
+uint32_t getHeaterPower(uint16_t vin, uint16_t temp)
+{
+  uint32_t res = (uint32_t)HEATER_RES * (10000 + HEATER_TC * ((int16_t)temp - 20)) / 10000;
+  return (uint32_t)vin * vin / res * HEATER_SPAN(ADC_SAMPLES) / FRAME_COUNTS;
+}
+
+// blends a gain from near (blend = 0) to far (blend = 256) and scales it by scale in 1/256
+uint16_t scheduleGain(uint16_t nearGain, uint16_t farGain, uint16_t blend, uint16_t scale)
+{
+  int32_t gain = nearGain + ((int32_t)farGain - nearGain) * blend / 256;
+  return min((uint32_t)gain * scale / 256, 0xFFFFUL);
+}
+
+// relay auto-tune: switches the heater fully on and off around the setpoint and identifies
+// ultimate gain and period of the resulting oscillation; called once per control period
+void AutoTune()
+{
+  tuneTicks++;
+  tuneMax = max(tuneMax, CurrentTemp);
+  tuneMin = min(tuneMin, CurrentTemp);
+
+  if (tuneHeating && CurrentTemp > (int16_t)Setpoint + TUNE_HYSTERESIS)
+    tuneHeating = false;
+  else if (!tuneHeating && CurrentTemp < (int16_t)Setpoint - TUNE_HYSTERESIS)
+  {
+    // heater switches on: one oscillation cycle completed
+    tuneHeating = true;
+    handleMoved = true; // keep the station awake
+    if (++tuneCycle > TUNE_SKIP)
+    {
+      tunePeriods += tuneTicks;
+      tuneAmps += tuneMax - tuneMin;
+    }
+    tuneTicks = 0;
+    tuneMax = tuneMin = CurrentTemp;
+  }
+  Output = tuneHeating ? 0 : 255;
+
+  if (tuneCycle >= TUNE_SKIP + TUNE_CYCLES)
+  {
+    // ultimate gain Ku = 4 * d / (pi * a) with relay amplitude d = 255 / 2 and a = half peak-to-peak
+    uint32_t ku = 83117UL * TUNE_CYCLES / max(tuneAmps, (uint16_t)TUNE_CYCLES);   // Ku in 1/256
+    // normalize to the heater power the gains are scheduled from (GAIN_VIN and GAIN_TEMP)
+    ku = ku * constrain(getHeaterPower(Vin, Setpoint) * 256 / getHeaterPower(GAIN_VIN, GAIN_TEMP), 64, 1024) / 256;
+    uint32_t pu = (uint32_t)tunePeriods * CONTROL_PERIOD / TUNE_CYCLES;            // Pu in ms
+    // Ziegler-Nichols "no overshoot" rule: Kp = 0.2 * Ku, Ti = Pu / 2, Td = Pu / 3
+    tuneGains[0] = constrain(ku / 5, 1, 0xFFFF);
+    tuneGains[1] = min(ku * 400 / pu, 0xFFFFUL);
+    tuneGains[2] = min(ku / 15 * pu / 1000, 0xFFFFUL);
+    tuneState = TUNE_DONE;
+  }
+  else if (++tuneTotal > (uint16_t)TUNE_TIMEOUT * CONTROL_RATE || CurrentTemp > (int16_t)Setpoint + 50)
+    tuneState = TUNE_FAILED;
+
+  if (tuneState != TUNE_RUNNING)
+  {
+    inTuneMode = false;
+    Output = 255;
+    ctrl.SetMode(AUTOMATIC); // restart PID bumpless from heater off
+    displayDue = true;
+  }
+}
+
+// benchmark: runs the scripted phases and records the step response of each phase
+// using the isWorky criterion on the phase setpoint; called once per control period
+void Benchmark()
+{
+  sleepmillis = boostmillis = millis(); // keep the timers from interfering
+  inSleepMode = (benchPhase == BENCH_SLEEP);
+  inBoostMode = (benchPhase == BENCH_BOOST);
+  inOffMode = false;
+
+  if (benchPhase == BENCH_COOL)
+  {
+    if (CurrentTemp < BENCH_COLD)
+      BenchmarkPhase(BENCH_HEAT);
+    return;
+  }
+
+  BenchResult *result = &benchResults[benchPhase - BENCH_HEAT];
+  benchTicks++;
+  benchDuty += HEATER_PWM; // heater value of the last frame
+  if (benchTicks > (uint16_t)(BENCH_TIMEOUT + BENCH_HOLD) * CONTROL_RATE)
+  {
+    BenchmarkEnd(); // setpoint not reached
+    return;
+  }
+  if (benchForced)
+  {
+    // load phase: the step response is recorded from the end of the cool-down
+    if (CurrentTemp <= (int16_t)benchTarget - BENCH_DROP)
+    {
+      benchForced = false;
+      benchTicks = 0;
+      benchDuty = 0;
+    }
+    return;
+  }
+
+  int16_t deviation = benchRising ? CurrentTemp - (int16_t)benchTarget : (int16_t)benchTarget - CurrentTemp;
+  if (!benchReached)
+  {
+    if (abs(CurrentTemp - (int16_t)benchTarget) < 5)
+    {
+      benchReached = benchTicks;
+      result->reach = (uint32_t)benchTicks * 10 / CONTROL_RATE;
+    }
+    return;
+  }
+
+  uint16_t held = benchTicks - benchReached;
+  result->overshoot = max(result->overshoot, deviation);
+  if (held >= BENCH_HOLD * CONTROL_RATE / 2)
+  {
+    benchMax = max(benchMax, CurrentTemp);
+    benchMin = min(benchMin, CurrentTemp);
+  }
+  if (held >= BENCH_HOLD * CONTROL_RATE)
+  {
+    result->ripple = min(benchMax - benchMin, 255);
+    result->duty = benchDuty * 100 / 255 / benchTicks;
+    benchCompleted++;
+    BenchmarkPhase(benchPhase + 1);
+  }
+}
+
+// starts a benchmark phase
+void BenchmarkPhase(uint8_t phase)
+{
+  benchPhase = phase;
+  if (phase == BENCH_DONE)
+  {
+    BenchmarkEnd();
+    return;
+  }
+  benchTarget = (phase == BENCH_SLEEP) ? SleepTemp : (phase == BENCH_BOOST) ? SetTemp + BoostTemp : SetTemp;
+  benchRising = ((int16_t)benchTarget > CurrentTemp);
+  benchForced = (phase == BENCH_COOL) || (phase == BENCH_LOAD);
+  benchTicks = benchReached = 0;
+  benchDuty = 0;
+  benchMax = 0;
+  benchMin = 0x7FFF;
+  displayDue = true;
+  if (phase != BENCH_HEAT)
+    beep();
+}
+
+// finishes or aborts the benchmark, restores the normal working mode and sends the results
+void BenchmarkEnd()
+{
+  inBenchMode = false;
+  benchForced = false;
+  inBoostMode = false;
+  inSleepMode = false;
+  handleMoved = true; // reset all timers
+  displayDue = true;
+  beep(BEEP_DOUBLE);
+  if (!serialList)
+  {
+    serialList = LIST_BENCH;
+    serialIndex = 0;
+  }
+}
+
+// sets the heater PWM value; OCR1A is double buffered by Timer1, so the new value
+// takes effect with the next PWM frame and the current frame is never truncated;
+// the heater span follows the length of the next measurement window
+void setHeater(uint8_t pwm)
+{
+  uint8_t samples = windowSamples();
+  uint16_t compare = 0xFFFF; // above TOP: no compare match, heater stays off
+  if (pwm)
+    compare = FRAME_COUNTS - (uint32_t)pwm * HEATER_SPAN(samples) / 255;
+  noInterrupts();
+  heaterPWM = pwm;
+  OCR1A = compare;
+  if (TIFR1 & bit(TOV1))
+    samples = min(samples, adcNextSamples); // TOP just passed: fit the window to both compare values
+  adcNextSamples = samples;
+  interrupts();
+}
+
+// samples of the next measurement window: short windows leave more heater power while
+// ramping or recovering, long windows average out the noise while holding the setpoint
+uint8_t windowSamples()
+{
+  if ((gap >= ADC_GAP) || loadBurst || modelBurst)
+    return ADC_FAST;
+  if (isWorky && filterSettled)
+    return ADC_HOLD;
+  return ADC_SAMPLES;
+}
+
+// queues a beep pattern on the buzzer; returns immediately, the pattern is played by the scheduler tick
+void beep(uint8_t pattern)
+{
+  if (!beepEnable)
+    return;
+  noInterrupts();
+  uint8_t head = (beepHead + 1) & (BEEP_QUEUE - 1);
+  if (head != beepTail)
+  { // drop the beep if the queue is full
+    beepQueue[beepHead] = pattern;
+    beepHead = head;
+    if (!beepTicks)
+      beepNext();
+  }
+  interrupts();
+}
+
+// advances to the next step of the current or next queued pattern and switches the tone;
+// called by the scheduler tick or with interrupts disabled
+void beepNext()
+{
+  uint8_t ticks = 0;
+  if (beepStep + 1 < BEEP_STEPS)
+    ticks = BeepPatterns[beepPattern][++beepStep];
+  if (!ticks && (beepHead != beepTail))
+  {
+    beepPattern = beepQueue[beepTail];
+    beepTail = (beepTail + 1) & (BEEP_QUEUE - 1);
+    beepStep = 0;
+    ticks = BeepPatterns[beepPattern][0];
+  }
+  if (!ticks)
+    beepStep = BEEP_STEPS; // idle
+  if (ticks && !(beepStep & 1))
+    TCCR0A |= bit(COM0B1); // tone on (50% PWM)
+  else
+    TCCR0A &= ~bit(COM0B1); // tone off, pin is low
+  beepTicks = ticks;
+}
+
+// sets start values for rotary encoder
+void setRotary(int rmin, int rmax, int rstep, int rvalue)
+{
+  countMin = rmin << Hardware::rotaryShift;
+  countMax = rmax << Hardware::rotaryShift;
+  countStep = ECReverse ? -rstep : rstep;
+  count = rvalue << Hardware::rotaryShift;
+}
+
+// reads current rotary encoder value
+int getRotary()
+{
+  return (count >> Hardware::rotaryShift);
+}
+
+// returns the taken event of the rotary encoder switch once (INPUT_NONE if there is none)
+uint8_t getButton()
+{
+  uint8_t event = buttonEvent;
+  buttonEvent = INPUT_NONE;
+  return event;
+}
+
+// takes the queued input events: turns are applied to the rotary value, faster turns by larger
+// steps if the range has enough steps; stops at a button event until it was read by getButton()
+void INPUTCheck()
+{
+  while (!buttonEvent && (inputTail != inputHead))
+  {
+    noInterrupts();
+    InputEvent event = {inputQueue[inputTail].type, inputQueue[inputTail].delta, inputQueue[inputTail].ticks};
+    inputTail = (inputTail + 1) & (INPUT_QUEUE - 1);
+    interrupts();
+    if (event.type != INPUT_TURN)
+    {
+      buttonEvent = event.type;
+      break;
+    }
+    int step = countStep;
+    if ((countMax - countMin) >= (ENCODER_RANGE << Hardware::rotaryShift) * abs(countStep))
+    {
+      if (event.ticks < ENCODER_FASTER)
+        step *= 4;
+      else if (event.ticks < ENCODER_FAST)
+        step *= 2;
+    }
+    count = constrain(count + event.delta * step, countMin, countMax);
+  }
+}
+
+// appends an input event to the queue and drops it if the queue is full; called by the interrupts
+void inputPush(uint8_t type, int8_t delta)
+{
+  uint8_t head = (inputHead + 1) & (INPUT_QUEUE - 1);
+  if (head != inputTail)
+  {
+    inputQueue[inputHead].type = type;
+    inputQueue[inputHead].delta = delta;
+    inputQueue[inputHead].ticks = encoderTicks;
+    inputHead = head;
+  }
+}
+
+// debounces the rotary encoder switch and queues its click, double-click and long press events;
+// called by the scheduler tick
+void buttonTick()
+{
+  if (buttonTicks < 0xFFFF)
+    buttonTicks++;
+  if (encoderTicks < 0xFF)
+    encoderTicks++;
+  if (!Hardware::Button::read() == buttonDown)
+    buttonBounce = 0;
+  else if (++buttonBounce >= BUTTON_DEBOUNCE)
+  { // new state is stable
+    buttonBounce = 0;
+    buttonDown = !buttonDown;
+    if (buttonDown)
+    {
+      buttonSecond = buttonClicked && (buttonTicks < BUTTON_DOUBLE);
+      buttonLong = false;
+    }
+    else if (!buttonLong)
+      inputPush(buttonSecond ? INPUT_DOUBLE : INPUT_CLICK, 0);
+    buttonClicked = !buttonDown && !buttonLong && !buttonSecond;
+    buttonTicks = 0;
+  }
+  if (buttonDown && !buttonLong && (buttonTicks >= BUTTON_LONG))
+  {
+    buttonLong = true;
+    inputPush(INPUT_LONG, 0);
+  }
+}
+
+// reads user settings and the current tip from the newest valid record of the store; without
+// one, settings and tips are migrated from a record of version 3 (written in the background),
+// 2 or 1 or the legacy layout or set to defaults (written right away)
+void getEEPROM()
+{
+  uint16_t seq;
+  uint8_t newest = storeNewest(STORE_START, STORE_VERSION, STORE_RECORD, &seq);
+  if (newest < STORE_SLOTS)
+  {
+    uint16_t addr = STORE_START + newest * STORE_RECORD + STORE_HEADER;
+    for (uint16_t i = 0; i < STORE_PAYLOAD; i++)
+      *storeData(i) = EEPROM.read(addr + i);
+    storeSlot = newest;
+    storeSeq = seq;
+    if (V3_MIGRATE)
+    { // an interrupted migration continues
+      migrateShift = EEPROM.read(MIGRATE_SHIFT);
+      migrateStep = EEPROM.read(MIGRATE_STEP);
+    }
+    return;
+  }
+  storeSlot = STORE_SLOTS - 1;
+  if (V3_MIGRATE && ((newest = storeNewest(STORE_OLD, 3, STORE_V3_RECORD, &seq)) < STORE_SLOTS))
+  {
+    getV3Record(STORE_OLD + newest * STORE_V3_RECORD + STORE_HEADER);
+    storeSeq = seq;
+    updateEEPROM(); // the migration starts once the record is written
+    return;
+  }
+
+  // all tips are read and packed before the catalogue is written; catalogue and record are
+  // written once right away (about a second) where they do not overlap the old data, so a
+  // power failure before the record is complete starts the migration over
+  uint8_t packed[LEGACY_TIPS][TIP_RECORD];
+  uint16_t ident = (EEPROM.read(0) << 8) | EEPROM.read(1);
+  uint8_t slot = 0;    // slot of the first record
+  bool copied = false; // tips of the legacy layout already in the catalogue
+  storeSeq = 0;
+  TipBase = 0;
+  if ((newest = storeNewest(STORE_OLD, 2, STORE_V2_RECORD, &seq)) < STORE_SLOTS)
+  {
+    uint16_t addr = STORE_OLD + newest * STORE_V2_RECORD;
+    getOldRecord(addr + STORE_HEADER, true, packed);
+    storeSeq = seq;
+    TipBase = tipBehind(addr + STORE_V2_RECORD);
+  }
+  else if ((newest = storeNewest(STORE_OLD, 1, STORE_V1_RECORD, &seq)) < STORE_SLOTS)
+  {
+    uint16_t addr = STORE_OLD + newest * STORE_V1_RECORD;
+    getOldRecord(addr + STORE_HEADER, false, packed);
+    storeSeq = seq;
+    TipBase = tipBehind(addr + STORE_V1_RECORD);
+  }
+  else if ((ident == EEPROM_IDENT) || (ident == LEGACY_COPIED))
+  { // the last slot overlaps the tips of the layout, but not its ident and settings
+    getLegacyEEPROM(packed);
+    slot = STORE_SLOTS - 1;
+    copied = (ident == LEGACY_COPIED);
+  }
+  else
+  {
+    setDefaultTip();
+    tipPack(&ActiveTip, packed[0]);
+  }
+
+  NumberOfTips = constrain(NumberOfTips, 1, LEGACY_TIPS);
+  CurrentTip = min(CurrentTip, NumberOfTips - 1);
+  if (!copied)
+  {
+    for (uint8_t tip = 0; tip < NumberOfTips; tip++)
+      for (uint8_t i = 0; i < TIP_RECORD; i++)
+        EEPROM.update(tipAddr(tip) + i, packed[tip][i]);
+    if (slot)
+      EEPROM.update(1, LEGACY_COPIED & 0xFF);
+  }
+  tipLoad(CurrentTip, &ActiveTip);
+  storeSlot = (slot + STORE_SLOTS - 1) % STORE_SLOTS;
+  updateEEPROM();
+  storeMillis -= STORE_DELAY;
+  while (storePending || storeWriting)
+    EEPROMCheck();
+}
+
+// returns the first slot of the catalogue behind the given address of an old record
+uint8_t tipBehind(uint16_t end)
+{
+  return (end <= TIP_START) ? 0 : ((end - TIP_START + TIP_RECORD - 1) / TIP_RECORD) % TIPMAX;
+}
+
+// reads the settings and the current tip of a record of version 3 and prepares the migration of
+// its catalogue; the first step waits for the record of the current version, which replaces
+// the old one for good (the old records are overwritten by the new catalogue). Tips that do
+// not fit into the catalogue are dropped with a notice.
+void getV3Record(uint16_t addr)
+{
+  for (uint16_t i = 0; i < STORE_V3_RECORD - STORE_HEADER - 2; i++)
+    *storeData(i) = EEPROM.read(addr + i);
+  memset(ActiveTip.usage, 0, sizeof(ActiveTip.usage));
+
+  migrateShift = TipBase % V3_TIPS;
+  migrateStep = 0;
+  migrateStaged = false;
+  EEPROM.update(MIGRATE_SHIFT, migrateShift);
+  EEPROM.update(MIGRATE_STEP, migrateStep);
+  TipBase = 0;
+  if (NumberOfTips > TIPMAX)
+  { // the tips behind the catalogue are lost, the current one takes the last slot
+    uiMessage = TruncateMessage;
+    uiNumberOfItems = NUMITEMS(TruncateMessage);
+    UIOpen(UI_NOTICE);
+  }
+  NumberOfTips = constrain(NumberOfTips, 1, TIPMAX);
+  CurrentTip = min(CurrentTip, NumberOfTips - 1);
+}
+
+// reads the settings of a record of version 1 or 2 and packs its tips; the settings are
+// followed by the arrays of names, calibrations, gains and (version 2) thermal models
+void getOldRecord(uint16_t addr, bool models, uint8_t packed[][TIP_RECORD])
+{
+  for (uint16_t i = 0; i < STORE_SETTINGS; i++)
+    *storeData(i) = EEPROM.read(addr + i);
+  for (uint8_t tip = 0; tip < LEGACY_TIPS; tip++)
+  {
+    uint16_t field = addr + STORE_SETTINGS;
+    eepromRead(field + tip * sizeof(ActiveTip.name), ActiveTip.name, sizeof(ActiveTip.name));
+    field += LEGACY_TIPS * sizeof(ActiveTip.name);
+    uint16_t cal[LEGACY_CALPOINTS + 1];
+    eepromRead(field + tip * sizeof(cal), cal, sizeof(cal));
+    field += LEGACY_TIPS * sizeof(cal);
+    calLegacy(cal);
+    eepromRead(field + tip * sizeof(ActiveTip.gains), ActiveTip.gains, sizeof(ActiveTip.gains));
+    field += LEGACY_TIPS * sizeof(ActiveTip.gains);
+    memset(ActiveTip.model, 0, sizeof(ActiveTip.model));
+    memset(ActiveTip.usage, 0, sizeof(ActiveTip.usage));
+    if (models)
+      eepromRead(field + tip * sizeof(ActiveTip.model), ActiveTip.model, sizeof(ActiveTip.model));
+    tipPack(&ActiveTip, packed[tip]);
+  }
+}
+
+// sets the calibration of the current tip from one of the legacy layouts (temperatures at LegacyADC
+// and the chip temperature), evaluated at CalADC on the curve buildTempTable() would draw
+void calLegacy(const uint16_t *cal)
+{
+  int16_t zero = CJC_ENABLE ? cal[LEGACY_CALPOINTS] : TEMPZERO;
+  for (uint8_t k = 0; k < CALPOINTS; k++)
+  {
+    uint8_t segment = 0;
+    while ((segment < LEGACY_CALPOINTS - 1) && (CalADC[k] >= LegacyADC[segment]))
+      segment++;
+    int16_t x0 = segment ? LegacyADC[segment - 1] : 0;
+    int16_t y0 = segment ? cal[segment - 1] : zero;
+    ActiveTip.cal[k] = map(CalADC[k], x0, LegacyADC[segment], y0, cal[segment]);
+  }
+  ActiveTip.cal[CALPOINTS] = cal[LEGACY_CALPOINTS];
+}
+
+// reads user settings from the legacy layout (fixed offsets, tips from offset 17) and packs its tips
+void getLegacyEEPROM(uint8_t packed[][TIP_RECORD])
+{
+  DefaultTemp = (EEPROM.read(2) << 8) | EEPROM.read(3);
+  SleepTemp = (EEPROM.read(4) << 8) | EEPROM.read(5);
+  BoostTemp = EEPROM.read(6);
+  time2sleep = EEPROM.read(7);
+  time2off = EEPROM.read(8);
+  timeOfBoost = EEPROM.read(9);
+  MainScrType = EEPROM.read(10);
+  ControlType = EEPROM.read(11);
+  beepEnable = EEPROM.read(12);
+  BodyFlip = EEPROM.read(13);
+  ECReverse = EEPROM.read(14);
+  CurrentTip = EEPROM.read(15);
+  NumberOfTips = EEPROM.read(16);
+
+  uint8_t i, j;
+  uint16_t counter = 17;
+  for (i = 0; i < LEGACY_TIPS; i++)
+  {
+    for (j = 0; j < TIPNAMELENGTH; j++)
+    {
+      ActiveTip.name[j] = EEPROM.read(counter++);
+    }
+    uint16_t cal[LEGACY_CALPOINTS + 1];
+    for (j = 0; j < LEGACY_CALPOINTS + 1; j++)
+    {
+      cal[j] = EEPROM.read(counter++) << 8;
+      cal[j] |= EEPROM.read(counter++);
+    }
+    calLegacy(cal);
+
+    // tuned PID gains, erased cells read as not tuned
+    for (j = 0; j < 3; j++)
+    {
+      uint16_t addr = EEPROM_GAINS + (i * 3 + j) * 2;
+      ActiveTip.gains[j] = (EEPROM.read(addr) << 8) | EEPROM.read(addr + 1);
+    }
+    if (ActiveTip.gains[0] == 0xFFFF)
+      ActiveTip.gains[0] = 0;
+    memset(ActiveTip.model, 0, sizeof(ActiveTip.model));
+    memset(ActiveTip.usage, 0, sizeof(ActiveTip.usage));
+    tipPack(&ActiveTip, packed[i]);
+  }
+}
+
+// copies bytes from the EEPROM
+void eepromRead(uint16_t addr, void *data, uint8_t size)
+{
+  for (uint8_t i = 0; i < size; i++)
+    ((uint8_t *)data)[i] = EEPROM.read(addr + i);
+}
+
+// returns the slot of the newest valid record of the given version and record size in the slots
+// from start on (STORE_SLOTS if there is none) and its sequence number
+uint8_t storeNewest(uint16_t start, uint8_t version, uint16_t record, uint16_t *newestSeq)
+{
+  uint8_t newest = STORE_SLOTS;
+  uint16_t seq;
+  for (uint8_t slot = 0; slot < STORE_SLOTS; slot++)
+  {
+    if (storeValid(start + slot * record, version, record, &seq) &&
+        ((newest == STORE_SLOTS) || ((int16_t)(seq - *newestSeq) > 0)))
+    {
+      newest = slot;
+      *newestSeq = seq;
+    }
+  }
+  return newest;
+}
+
+// checks version and CRC of a record and returns its sequence number
+bool storeValid(uint16_t addr, uint8_t version, uint16_t record, uint16_t *seq)
+{
+  if (EEPROM.read(addr) != version)
+    return false;
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < record - 2; i++)
+    crc = _crc16_update(crc, EEPROM.read(addr + i));
+  *seq = EEPROM.read(addr + 1) | (EEPROM.read(addr + 2) << 8);
+  return crc == (EEPROM.read(addr + record - 2) | (EEPROM.read(addr + record - 1) << 8));
+}
+
+// returns a pointer to the given byte of the record payload
+uint8_t *storeData(uint16_t index)
+{
+  const StoreField *field = StoreFields;
+  while (index >= field->size)
+    index -= (field++)->size;
+  return (uint8_t *)field->data + index;
+}
+
+// schedules writing the user settings into the next slot of the store; changes within
+// STORE_DELAY are batched into one record
+void updateEEPROM()
+{
+  storePending = true;
+  storeMillis = millis();
+}
+
+// writes the pending record in the background; a byte is only written if the EEPROM is
+// ready and unchanged bytes are skipped, so a call never waits for the EEPROM.
+// Version, sequence number and payload are written first, the CRC completes the record.
+// A catalogue record being written goes first, as the next record may refer to it. A migration
+// of the catalogue continues whenever no record is pending.
+void EEPROMCheck()
+{
+  while ((tipWritePos < tipWriteSize) && eeprom_is_ready())
+  {
+    EEPROM.update(tipWriteAddr + tipWritePos, tipWrite[tipWritePos]);
+    tipWritePos++;
+  }
+  if (tipWritePos < tipWriteSize)
+    return;
+
+  if ((migrateStep != MIGRATE_NONE) && !storePending && !storeWriting)
+  {
+    migrateNext();
+    return;
+  }
+  if (!storeWriting)
+  {
+    if (!storePending || (millis() - storeMillis < STORE_DELAY))
+      return;
+    storePending = false;
+    storeWriting = true;
+    storeSlot = (storeSlot + 1) % STORE_SLOTS;
+    storeSeq++;
+    storePos = 0;
+    storeCrc = 0xFFFF;
+  }
+
+  uint16_t addr = STORE_START + storeSlot * STORE_RECORD;
+  while (eeprom_is_ready())
+  {
+    uint8_t value;
+    if (storePos == 0)
+      value = STORE_VERSION;
+    else if (storePos < STORE_HEADER)
+      value = (storePos == 1) ? (storeSeq & 0xFF) : (storeSeq >> 8);
+    else if (storePos < STORE_RECORD - 2)
+      value = *storeData(storePos - STORE_HEADER);
+    else
+      value = (storePos == STORE_RECORD - 2) ? (storeCrc & 0xFF) : (storeCrc >> 8);
+    if (storePos < STORE_RECORD - 2)
+      storeCrc = _crc16_update(storeCrc, value);
+    EEPROM.update(addr + storePos, value);
+    if (++storePos >= STORE_RECORD)
+    {
+      storeWriting = false;
+      return;
+    }
+  }
+}
+
+// returns the EEPROM address of the catalogue record of a tip
+uint16_t tipAddr(uint8_t tip)
+{
+  return TIP_START + ((TipBase + tip) % TIPMAX) * TIP_RECORD;
+}
+
+// writes the low bits of a value into a packed record from bit *pos on
+void packBits(uint8_t *record, uint8_t *pos, uint16_t value, uint8_t bits)
+{
+  for (uint8_t i = 0; i < bits; i++, (*pos)++)
+    if (bitRead(value, i))
+      record[*pos >> 3] |= bit(*pos & 7);
+}
+
+// reads a value of the given bits from a packed record from bit *pos on
+uint16_t unpackBits(const uint8_t *record, uint8_t *pos, uint8_t bits)
+{
+  uint16_t value = 0;
+  for (uint8_t i = 0; i < bits; i++, (*pos)++)
+    if (bitRead(record[*pos >> 3], *pos & 7))
+      value |= bit(i);
+  return value;
+}
+
+// packs the values of a tip into a catalogue record (name characters outside of ASCII 32..95
+// become spaces, lower case letters upper case)
+void tipPack(const TipRecord *tip, uint8_t *record)
+{
+  uint8_t pos = 0;
+  bool end = false;
+  memset(record, 0, TIP_RECORD);
+  for (uint8_t i = 0; i < TIPNAMELENGTH - 1; i++)
+  {
+    char c = tip->name[i];
+    end |= !c;
+    if (end)
+      c = ' ';
+    if ((c >= 'a') && (c <= 'z'))
+      c -= 'a' - 'A';
+    packBits(record, &pos, ((c > ' ') && (c <= '_')) ? c - ' ' : 0, 6);
+  }
+  packBits(record, &pos, tip->cal[0], 10);
+  for (uint8_t i = 1; i < CALPOINTS; i++)
+    packBits(record, &pos, tip->cal[i] - tip->cal[i - 1], 9);
+  packBits(record, &pos, min(tip->cal[CALPOINTS], 63), 6);
+  memcpy(record + TIP_GAINS, tip->gains, sizeof(tip->gains));
+  memcpy(record + TIP_GAINS + sizeof(tip->gains), tip->model, sizeof(tip->model));
+  memcpy(record + TIP_USAGE, tip->usage, sizeof(tip->usage));
+}
+
+// unpacks a catalogue record into the values of a tip (trailing spaces of the name are removed)
+void tipUnpack(const uint8_t *record, TipRecord *tip)
+{
+  uint8_t pos = 0;
+  for (uint8_t i = 0; i < TIPNAMELENGTH - 1; i++)
+    tip->name[i] = ' ' + unpackBits(record, &pos, 6);
+  tip->name[TIPNAMELENGTH - 1] = 0;
+  for (uint8_t i = TIPNAMELENGTH - 1; i && (tip->name[i - 1] == ' '); i--)
+    tip->name[i - 1] = 0;
+  tip->cal[0] = unpackBits(record, &pos, 10);
+  for (uint8_t i = 1; i < CALPOINTS; i++)
+    tip->cal[i] = tip->cal[i - 1] + unpackBits(record, &pos, 9);
+  tip->cal[CALPOINTS] = unpackBits(record, &pos, 6);
+  memcpy(tip->gains, record + TIP_GAINS, sizeof(tip->gains));
+  memcpy(tip->model, record + TIP_GAINS + sizeof(tip->gains), sizeof(tip->model));
+  memcpy(tip->usage, record + TIP_USAGE, sizeof(tip->usage));
+}
+
+// reads a tip from its catalogue record
+void tipLoad(uint8_t tip, TipRecord *record)
+{
+  uint8_t packed[TIP_RECORD];
+  eepromRead(tipAddr(tip), packed, TIP_RECORD);
+  tipUnpack(packed, record);
+}
+
+// reads a tip: the current tip from RAM, the others from the catalogue
+void tipRead(uint8_t tip, TipRecord *record)
+{
+  if (tip == CurrentTip)
+    *record = ActiveTip;
+  else
+    tipLoad(tip, record);
+}
+
+// starts writing the first size bytes of tipWrite to addr in the background
+void tipStage(uint16_t addr, uint8_t size)
+{
+  tipWriteAddr = addr;
+  tipWriteSize = size;
+  tipWritePos = 0;
+}
+
+// starts writing the current tip into its catalogue record in the background (before another
+// tip is loaded, so the usage remainders are rounded into it)
+void tipSave()
+{
+  usageRound();
+  tipPack(&ActiveTip, tipWrite);
+  tipStage(tipAddr(CurrentTip), TIP_RECORD);
+}
+
+// returns true while a catalogue or store record is being written or the catalogue is migrated;
+// tips are only switched or staged in between, so a record always refers to completely written tips
+bool tipBusy()
+{
+  return storeWriting || (tipWritePos < tipWriteSize) || (migrateStep != MIGRATE_NONE);
+}
+
+// stages the copy of a step of the catalogue migration and returns false after the last step.
+// First the cycles of a juggling rotation turn the old ring to start at slot 0, then the records,
+// which grow by the usage counters but start lower, are moved in an order that moves every
+// record before it is overwritten. Every copy goes through the scratch record or between slots
+// that are not written before the next step, so a step interrupted by a reset can be repeated.
+bool migrateStage(uint8_t step)
+{
+  uint8_t cycles = V3_TIPS;
+  for (uint8_t rest = migrateShift; rest;)
+  { // greatest common divisor of the slots and the shift
+    uint8_t next = cycles % rest;
+    cycles = rest;
+    rest = next;
+  }
+  uint8_t length = V3_TIPS / cycles;                      // slots per cycle
+  uint8_t rotation = migrateShift ? V3_TIPS + cycles : 0; // steps of the rotation
+  uint16_t from, to;
+  uint8_t size = V3_TIP_RECORD;
+  if (step < rotation)
+  { // the first slot of a cycle goes to the scratch record, each slot takes the one shift
+    // further and the last one takes the scratch record
+    uint8_t start = step / (length + 1), pos = step % (length + 1);
+    from = (pos < length) ? V3_TIP_START + (start + pos * migrateShift) % V3_TIPS * V3_TIP_RECORD : MIGRATE_START;
+    to = pos ? V3_TIP_START + (start + (pos - 1) * migrateShift) % V3_TIPS * V3_TIP_RECORD : MIGRATE_START;
+  }
+  else
+  { // first from the last tip on the ones moving up, then from the first tip on the others;
+    // each record goes to the scratch record and from there with zero usage counters to its slot
+    uint8_t n = (step - rotation) / 2, down = 0;
+    if (n >= NumberOfTips)
+      return false;
+    while ((down < NumberOfTips) && (tipAddr(down) < V3_TIP_START + down * V3_TIP_RECORD))
+      down++;
+    uint8_t tip = (n < NumberOfTips - down) ? NumberOfTips - 1 - n : n - (NumberOfTips - down);
+    bool scratch = (step - rotation) & 1; // from the scratch record
+    from = scratch ? MIGRATE_START : V3_TIP_START + tip * V3_TIP_RECORD;
+    to = scratch ? tipAddr(tip) : MIGRATE_START;
+    if (scratch)
+      size = TIP_RECORD;
+  }
+  eepromRead(from, tipWrite, V3_TIP_RECORD);
+  memset(tipWrite + V3_TIP_RECORD, 0, TIP_RECORD - V3_TIP_RECORD);
+  tipStage(to, size);
+  return true;
+}
+
+// continues the catalogue migration: stages the next step and, once its copy is written,
+// records it as done
+void migrateNext()
+{
+  if (!eeprom_is_ready())
+    return;
+  if (migrateStaged)
+    migrateStep++;
+  else if (migrateStage(migrateStep))
+  {
+    migrateStaged = true;
+    return;
+  }
+  else
+    migrateStep = MIGRATE_NONE;
+  migrateStaged = false;
+  EEPROM.update(MIGRATE_STEP, migrateStep);
+}
+
+// selects another tip: the current one is written into its catalogue record in the background
+// and the selected one is loaded; returns false if the EEPROM is busy
+bool tipSelect(uint8_t tip)
+{
+  if (tipBusy())
+    return false;
+  if (tip != CurrentTip)
+  {
+    tipSave();
+    CurrentTip = tip;
+    tipLoad(tip, &ActiveTip);
+  }
+  buildTempTable();
+  return true;
+}
+
+// check state and flip screen
+void SetFlip()
+{
+}
+
+// refreshes the current screen at DISPLAY_RATE; only one page is rendered and sent
+// per call, so a redraw never delays the control loop by more than one page transfer.
+// On the main screen only the pages of changed values are sent.
+void DISPLAYUpdate()
+{
+  // dim the display in sleep mode and switch it off in off mode, in between two frames
+  uint8_t power = DISPLAY_ON;
+  if (uiScreen == UI_MAIN)
+    power = inOffMode ? DISPLAY_OFF : (inSleepMode ? DISPLAY_DIM : DISPLAY_ON);
+  if ((power != displayPower) && !displayDirty)
+  {
+    if (!twiIdle())
+      return;
+    u8g.setPowerSave(power == DISPLAY_OFF);
+    u8g.setContrast((power == DISPLAY_DIM) ? CONTRAST_SLEEP : CONTRAST_WORK);
+    if (displayPower == DISPLAY_OFF)
+      displayFull = true; // the screen content is outdated
+    displayPower = power;
+    return;
+  }
+  if (displayPower == DISPLAY_OFF)
+  {
+    displayDue = false; // nothing to draw
+    return;
+  }
+
+  if (!displayDirty)
+  {
+    if (!displayDue)
+      return;
+    displayDue = false;
+    displayDirty = (uiScreen == UI_MAIN) ? MainSnapshot() : 0xFF;
+    if (displayFull)
+    {
+      displayFull = false;
+      displayDirty = 0xFF;
+    }
+    if (!displayDirty)
+      return; // nothing has changed
+  }
+
+  // render the next dirty page once the last one has been sent in the background
+  if (!twiIdle())
+    return;
+  uint8_t page = 0;
+  while (!bitRead(displayDirty, page))
+    page++;
+  bitClear(displayDirty, page);
+  u8g.setBufferCurrTileRow(page);
+  u8g.clearBuffer();
+  DrawScreen();
+  u8g.sendBuffer();
+}
+
+// lets the MCU sleep until the next interrupt if this loop pass has left nothing to do; every
+// task waiting for something is woken by its interrupt or the 1ms scheduler tick. In off
+// mode with the display switched off, the MCU powers down until the rotary encoder, its
+// switch or the handle vibration switch wakes it up (the UART does not wake it up)
+void POWERCheck()
+{
+#if POWER_SAVE
+  uint8_t mode = SLEEP_MODE_IDLE;
+  noInterrupts();
+  if ((bootStep != BOOT_DONE) || adcReady || displayDue || handleMoved || (displayDirty && twiIdle()) ||
+      (inputHead != inputTail) || buttonEvent || Serial.available())
+  {
+    interrupts();
+    return;
+  }
+#if POWER_SAVE > 1
+  if (inOffMode && (displayPower == DISPLAY_OFF) && (uiScreen == UI_MAIN) && (heaterPWM == HEATER_OFF) &&
+      (adcState == ADC_IDLE) && (beepStep == BEEP_STEPS) && !buttonDown && !buttonBounce && !storePending &&
+      !tipBusy() && !serialList &&
+      twiIdle() && (Serial.availableForWrite() == SERIAL_TX_BUFFER_SIZE - 1))
+  {
+    mode = SLEEP_MODE_PWR_DOWN;
+    TCCR1A = bit(WGM11);   // heater pin back to its idle level while Timer1 stops
+    ADCSRA &= ~bit(ADEN);  // switched on again by the next measurement window
+    PCIFR = bit(PCIF2);
+    PCICR |= bit(PCIE2);   // encoder switch wakes up too
+    wdt_disable();         // no control periods until the wake-up
+  }
+#endif
+  set_sleep_mode(mode);
+  sleep_enable();
+  interrupts();
+  sleep_cpu(); // the instruction after enabling interrupts is executed first, so no wake-up is missed
+  sleep_disable();
+  if (mode == SLEEP_MODE_PWR_DOWN)
+  {
+    PCICR &= ~bit(PCIE2);
+    TCCR1A = HEATER_COM | bit(WGM11);
+    wdt_enable(WATCHDOG_TIME);
+  }
+#endif
+}
+
+// takes a snapshot of the values drawn on the main screen (kept constant over all pages
+// of a frame) and returns the pages (bit 0 = top) whose content has changed
+uint8_t MainSnapshot()
+{
+  uint8_t status;
+  if (ShowTemp > 500)
+    status = 0;
+  else if (inOffMode)
+    status = 1;
+  else if (inSleepMode)
+    status = 2;
+  else if (inBoostMode)
+    status = 3;
+  else if (isWorky)
+    status = 4;
+  else if (Output < 180)
+    status = 5;
+  else
+    status = 6;
+  uint8_t ready = (status == 5) ? modelReady : 0;
+  uint16_t vin = (Vin + 50) / 100; // convert mV in V
+
+  // layout: setpoint and status on pages 0-1, current temperature on pages 2-6 (big
+  // numbers: pages 2-7), tip name and input voltage on pages 6-7
+  uint8_t dirty = 0;
+  if ((Setpoint != dispSetpoint) || (status != dispStatus) || (ready != dispReady))
+    dirty |= 0x03;
+  if (ShowTemp != dispTemp)
+    dirty |= MainScrType ? 0x7C : 0xFC;
+  if (MainScrType && ((vin != dispVin) || (CurrentTip != dispTip)))
+    dirty |= 0xC0;
+
+  dispSetpoint = Setpoint;
+  dispTemp = ShowTemp;
+  dispVin = vin;
+  dispStatus = status;
+  dispTip = CurrentTip;
+  dispReady = ready;
+  return dirty;
+}
+
+// prints a value given in tenths with one decimal
+void printTenths(int16_t value)
+{
+  if (value < 0)
+  {
+    u8g.print('-');
+    value = -value;
+  }
+  u8g.print(value / 10);
+  u8g.print('.');
+  u8g.print(value % 10);
+}
+
+// draws the main screen into the current page
+void MainScreen()
+{
+  static const char StatusText[][6] PROGMEM = {"ERROR", "  OFF", "SLEEP", "BOOST", "WORKY", " HEAT", " HOLD"};
+
+  // draw setpoint temperature
+  u8g.setFont(u8g_font_9x15);
+  u8g.setFontPosTop();
+  u8g.drawStr(0, 0, "SET:");
+  u8g.setCursor(40, 0);
+  u8g.print(dispSetpoint);
+
+  // draw status of heater, while heating up the predicted time until the setpoint is reached
+  if (dispReady)
+  {
+    u8g.setCursor(92, 0);
+    if (dispReady < 10)
+      u8g.print(' ');
+    u8g.print(dispReady);
+    u8g.print('s');
+  }
+  else
+  {
+    u8g.setCursor(83, 0);
+    u8g.print(reinterpret_cast<const __FlashStringHelper *>(StatusText[dispStatus]));
+  }
+
+  // rest depending on main screen type
+  if (MainScrType)
+  {
+    // draw current tip and input voltage
+    u8g.setCursor(0, 52);
+    u8g.print(ActiveTip.name);
+    u8g.setCursor(83, 52);
+    printTenths(dispVin);
+    u8g.print(F("V"));
+    // draw current temperature
+    u8g.setFont(u8g2_font_freedoomr25_tn);
+    u8g.setFontPosTop();
+    u8g.setCursor(37, 22);
+    if (dispTemp > 500)
+      u8g.print(F("000"));
+    else
+      u8g.print(dispTemp);
+  }
+  else
+  {
+    // draw current temperature in big figures
+    u8g.setFont(u8g2_font_fub42_tn);
+    u8g.setFontPosTop();
+    u8g.setCursor(15, 20);
+    if (dispTemp > 500)
+      u8g.print(F("000"));
+    else
+      u8g.print(dispTemp);
+  }
+}
+
+// handles the setup menu screens; called on every loop pass and never blocks,
+// so measurement and heater control keep running while the menus are open
+void UIHandler()
+{
+  if (uiScreen == UI_MAIN)
+    return;
+
+  // redraw immediately if the rotary encoder was turned
+  int rotary = getRotary();
+  if (rotary != uiLastRotary)
+  {
+    uiLastRotary = rotary;
+    displayDue = true;
+  }
+
+  uint8_t event = INPUT_NONE;
+  if (!tipBusy()) // presses wait while the EEPROM is written, they may switch tips
+    event = getButton();
+  bool pressed = (event != INPUT_NONE); // every click counts here, a long press too
+
+  // menu screens
+  if (uiScreen <= UI_SURE)
+  {
+    uint8_t selected = rotary;
+    uiArrow = constrain(uiArrow + selected - uiSelected, 0, 2);
+    uiSelected = selected;
+    if (pressed)
+    {
+      beep();
+      MenuSelect();
+    }
+    return;
+  }
+
+  switch (uiScreen)
+  {
+  case UI_INPUT:
+    if (pressed)
+    {
+      beep();
+      InputDone(rotary);
+    }
+    break;
+  case UI_INFO:
+    if (!rotary && (millis() - uiInfoMillis >= 1000))
+    {
+      uiInfoMillis = millis();
+      chipRequest = true; // Vin follows from the windows anyway
+    }
+    if (pressed)
+    {
+      beep();
+      UIBack();
+    }
+    break;
+  case UI_MESSAGE:
+    if (pressed)
+    {
+      beep();
+      UIBack();
+    }
+    break;
+  case UI_CHANGETIP:
+  {
+    uint8_t selected = rotary;
+    if (selected != uiSelected)
+    { // turning the encoder overrides the tip identification
+      identStop();
+      identTip = IDENT_NOTIP;
+    }
+    if ((identTip != IDENT_NOTIP) && !tipBusy())
+    { // identified tip: selected as if it was chosen
+      selected = identTip;
+      pressed = true;
+    }
+    uiArrow = constrain(uiArrow + selected - uiSelected, 0, 2);
+    uiSelected = selected;
+    if (pressed)
+    {
+      beep();
+      identStop();
+      identTip = IDENT_NOTIP;
+      tipSelect(selected);
+      if (uiTipInserted)
+      {
+        updateEEPROM();                                    // update setting in EEPROM
+        handleMoved = true;                                // reset all timers
+        RawTemp = getTipADC();                             // restart temp smooth algorithm
+        setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, SetTemp); // reset rotary encoder
+        UIOpen(UI_MAIN);
+      }
+      else
+        UIBack();
+    }
+    break;
+  }
+  case UI_CALIBRATION:
+    // a click takes the measured temperature of the point once the tip is settled at the
+    // setpoint, a long press finishes the session early (or cancels it before two points)
+    if (pressed && (event != INPUT_LONG))
+    {
+      if (!isWorky)
+        break;
+      beep();
+      uiCalADC[uiCalStep] = RawTemp;
+      uiCalMeasured[uiCalStep] = rotary;
+      uiCalChip[uiCalStep] = ChipTemp; // read by CJCCheck within CJC_INTERVAL
+      if (++uiCalStep < CAL_STEPS)
+      {
+        CalibrationStep();
+        break;
+      }
+    }
+    else if (event == INPUT_LONG)
+      beep();
+    else
+      break;
+    inCalibMode = false;
+    if ((uiCalStep >= 2) && calibrationFit(uiCalStep))
+      MenuOpen(UI_STORE, 0);
+    else
+      UIBack();
+    break;
+  case UI_AUTOTUNE:
+    if (pressed)
+    {
+      beep();
+      if (tuneState == TUNE_DONE)
+        MenuOpen(UI_TUNESTORE, 0);
+      else
+      {
+        if (inTuneMode)
+        {
+          inTuneMode = false; // abort auto-tune
+          ctrl.SetMode(AUTOMATIC);
+        }
+        if (tuneState == TUNE_FAILED)
+          MessageScreen(TuneFailMessage, NUMITEMS(TuneFailMessage));
+        else
+          UIBack();
+      }
+    }
+    break;
+  case UI_BENCHMARK:
+    if (pressed)
+    {
+      beep();
+      if (inBenchMode)
+        BenchmarkEnd(); // abort
+      else
+        UIBack();
+    }
+    break;
+  case UI_FAULT:
+    if (pressed)
+    { // acknowledged: the checks start over
+      beep();
+      faultCode = FAULT_NONE;
+      healthTicks = 0;
+      ctrl.SetMode(AUTOMATIC);
+      handleMoved = true;
+      setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, SetTemp);
+      UIOpen(UI_MAIN);
+    }
+    break;
+  case UI_NOTICE:
+    if (pressed)
+    {
+      beep();
+      UIOpen(UI_MAIN);
+    }
+    break;
+  case UI_INPUTNAME:
+    if (rotary == 31)
+      setRotary(31, 96, 1, 95);
+    if (rotary == 96)
+      setRotary(31, 96, 1, 32);
+    if (event == INPUT_DOUBLE)
+    { // the first click entered the last character, fill up with spaces
+      beep();
+      while (uiDigit < (TIPNAMELENGTH - 1))
+        ActiveTip.name[uiDigit++] = ' ';
+      ActiveTip.name[TIPNAMELENGTH - 1] = 0;
+      UIBack();
+    }
+    else if (pressed)
+    {
+      beep();
+      ActiveTip.name[uiDigit] = getRotary();
+      setRotary(31, 96, 1, 65);
+      if (++uiDigit >= (TIPNAMELENGTH - 1))
+      {
+        ActiveTip.name[TIPNAMELENGTH - 1] = 0;
+        UIBack();
+      }
+    }
+    break;
+  }
+}
+
+// switches to the given screen and starts a new frame on the OLED
+void UIOpen(uint8_t screen)
+{
+  uiScreen = screen;
+  uiLastRotary = getRotary();
+  displayDirty = 0;
+  displayFull = true;
+  displayDue = true;
+}
+
+// returns from a leaf screen to the menu item it was opened from
+void UIBack()
+{
+  MenuOpen(uiParent, uiParentSel);
+}
+
+// setup screen
 void SetupScreen()
 {
-  analogWrite(CONTROL_PIN, HEATER_OFF); // shut off heater
   beep();
-  uint16_t SaveSetTemp = SetTemp;
-  uint8_t selection = 0;
-  bool repeat = true;
+  uiSaveSetTemp = SetTemp;
+  MenuOpen(UI_SETUP, 0);
+}
+
+// leaves the setup menu and returns to the main screen
+void SetupExit()
+{
+  updateEEPROM();
+  handleMoved = true;
+  SetTemp = uiSaveSetTemp;
+  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, SetTemp);
+  UIOpen(UI_MAIN);
+}
 
-  while (repeat)
+// opens a menu screen with the given item preselected
+void MenuOpen(uint8_t screen, uint8_t selected)
+{
+  uiItems = MenuItems[screen - UI_SETUP];
+  uiNumberOfItems = MenuSizes[screen - UI_SETUP];
+  uiSelected = selected;
+  uiArrow = selected ? 1 : 0;
+  setRotary(0, uiNumberOfItems - 2, 1, selected);
+  UIOpen(screen);
+}
+
+// acts on the selected item of the current menu screen
+void MenuSelect()
+{
+  uint8_t selected = uiSelected;
+  switch (uiScreen)
   {
-    selection = MenuScreen(SetupItems, sizeof(SetupItems), selection);
-    switch (selection)
+  case UI_SETUP:
+    uiParent = UI_SETUP;
+    uiParentSel = selected;
+    switch (selected)
     {
     case 0:
-      TipScreen();
-      repeat = false;
+      MenuOpen(UI_TIP, 0);
       break;
     case 1:
-      TempScreen();
+      MenuOpen(UI_TEMP, 0);
       break;
     case 2:
-      TimerScreen();
+      MenuOpen(UI_TIMER, 0);
       break;
     case 3:
-      PIDenable = MenuScreen(ControlTypeItems, sizeof(ControlTypeItems), PIDenable);
+      MenuOpen(UI_CONTROLTYPE, ControlType);
       break;
     case 4:
-      MainScrType = MenuScreen(MainScreenItems, sizeof(MainScreenItems), MainScrType);
+      MenuOpen(UI_MAINSCREEN, MainScrType);
       break;
     case 5:
-      beepEnable = MenuScreen(BuzzerItems, sizeof(BuzzerItems), beepEnable);
+      MenuOpen(UI_BUZZER, beepEnable);
       break;
     case 6:
-      BodyFlip = MenuScreen(FlipItems, sizeof(FlipItems), BodyFlip);
-      SetFlip();
+      MenuOpen(UI_FLIP, BodyFlip);
       break;
     case 7:
-      ECReverse = MenuScreen(ECReverseItems, sizeof(ECReverseItems), ECReverse);
+      MenuOpen(UI_ECREVERSE, ECReverse);
       break;
     case 8:
-      InfoScreen();
+      uiInfoMillis = millis() - 1000;
+      setRotary(0, INFO_PAGES - 1, 1, 0);
+      profileReset();
+      UIOpen(UI_INFO);
+      break;
+    case 9:
+      BenchmarkScreen();
       break;
     default:
-      repeat = false;
+      SetupExit();
       break;
     }
-  }
-  updateEEPROM();
-  handleMoved = true;
-  SetTemp = SaveSetTemp;
-  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, SetTemp);
-}
-
-// tip settings screen
-void TipScreen()
-{
-  uint8_t selection = 0;
-  bool repeat = true;
-  while (repeat)
-  {
-    selection = MenuScreen(TipItems, sizeof(TipItems), selection);
-    switch (selection)
+    break;
+  case UI_TIP:
+    uiParent = UI_TIP;
+    uiParentSel = selected;
+    switch (selected)
     {
     case 0:
-      ChangeTipScreen();
+      ChangeTipScreen(false);
       break;
     case 1:
       CalibrationScreen();
       break;
     case 2:
-      InputNameScreen();
+      AutoTuneScreen();
       break;
     case 3:
-      DeleteTipScreen();
+      InputNameScreen();
       break;
     case 4:
+      DeleteTipScreen();
+      break;
+    case 5:
       AddTipScreen();
       break;
     default:
-      repeat = false;
+      SetupExit();
+      break;
+    }
+    break;
+  case UI_TEMP:
+    uiParent = UI_TEMP;
+    uiParentSel = selected;
+    switch (selected)
+    {
+    case 0:
+      setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, DefaultTemp);
+      InputScreen(DefaultTempItems);
+      break;
+    case 1:
+      setRotary(20, 200, TEMP_STEP, SleepTemp);
+      InputScreen(SleepTempItems);
+      break;
+    case 2:
+      setRotary(10, 100, TEMP_STEP, BoostTemp);
+      InputScreen(BoostTempItems);
+      break;
+    default:
+      MenuOpen(UI_SETUP, 1);
+      break;
+    }
+    break;
+  case UI_TIMER:
+    uiParent = UI_TIMER;
+    uiParentSel = selected;
+    switch (selected)
+    {
+    case 0:
+      setRotary(0, 30, 1, time2sleep);
+      InputScreen(SleepTimerItems);
+      break;
+    case 1:
+      setRotary(0, 60, 5, time2off);
+      InputScreen(OffTimerItems);
+      break;
+    case 2:
+      setRotary(0, 180, 10, timeOfBoost);
+      InputScreen(BoostTimerItems);
+      break;
+    default:
+      MenuOpen(UI_SETUP, 2);
       break;
     }
+    break;
+  case UI_CONTROLTYPE:
+    ControlType = selected;
+    MenuOpen(UI_SETUP, 3);
+    break;
+  case UI_MAINSCREEN:
+    MainScrType = selected;
+    MenuOpen(UI_SETUP, 4);
+    break;
+  case UI_BUZZER:
+    beepEnable = selected;
+    MenuOpen(UI_SETUP, 5);
+    break;
+  case UI_FLIP:
+    BodyFlip = selected;
+    SetFlip();
+    MenuOpen(UI_SETUP, 6);
+    break;
+  case UI_ECREVERSE:
+    ECReverse = selected;
+    MenuOpen(UI_SETUP, 7);
+    break;
+  case UI_STORE:
+    if (selected)
+    {
+      for (uint8_t i = 0; i < CALPOINTS + 1; i++)
+        ActiveTip.cal[i] = uiCalTemp[i];
+      buildTempTable();
+    }
+    UIBack();
+    break;
+  case UI_TUNESTORE:
+    if (selected)
+    {
+      for (uint8_t i = 0; i < 3; i++)
+        ActiveTip.gains[i] = tuneGains[i];
+    }
+    UIBack();
+    break;
+  case UI_SURE:
+    if (selected)
+    { // the last tip takes the place of the deleted one, its catalogue record follows on the next switch
+      uint8_t last = NumberOfTips - 1;
+      usageRound(); // the remainders of the deleted tip are dropped
+      tipLoad((CurrentTip == last) ? last - 1 : last, &ActiveTip);
+      if (CurrentTip == last)
+        CurrentTip--;
+      NumberOfTips--;
+      serialLoading = false; // the staged tips are behind the table
+      buildTempTable();
+    }
+    UIBack();
+    break;
+  }
+}
+
+// acts on the value entered on the input screen
+void InputDone(uint16_t value)
+{
+  if (uiParent == UI_TEMP)
+  {
+    if (uiParentSel == 0)
+      DefaultTemp = value;
+    else if (uiParentSel == 1)
+      SleepTemp = value;
+    else
+      BoostTemp = value;
+  }
+  else
+  {
+    if (uiParentSel == 0)
+      time2sleep = value;
+    else if (uiParentSel == 1)
+      time2off = value;
+    else
+      timeOfBoost = value;
+  }
+  UIBack();
+}
+
+// draws the current screen into the current page
+void DrawScreen()
+{
+  if (uiScreen <= UI_SURE && uiScreen != UI_MAIN)
+  {
+    MenuScreen();
+    return;
+  }
+  switch (uiScreen)
+  {
+  case UI_MAIN:
+    PROFILE(PROF_SCREEN, MainScreen());
+    break;
+  case UI_INPUT:
+    DrawInputScreen();
+    break;
+  case UI_INFO:
+    DrawInfoScreen();
+    break;
+  case UI_MESSAGE:
+    DrawMessageScreen();
+    break;
+  case UI_CHANGETIP:
+    DrawChangeTipScreen();
+    break;
+  case UI_CALIBRATION:
+    DrawCalibrationScreen();
+    break;
+  case UI_INPUTNAME:
+    DrawInputNameScreen();
+    break;
+  case UI_AUTOTUNE:
+    DrawAutoTuneScreen();
+    break;
+  case UI_BENCHMARK:
+    DrawBenchmarkScreen();
+    break;
+  case UI_FAULT:
+  case UI_NOTICE:
+    DrawMessageScreen();
+    break;
+  }
+}
+
+// draws the current menu screen
+void MenuScreen()
+{
+  u8g.setFont(u8g_font_9x15);
+  u8g.setFontPosTop();
+  u8g.drawStr(0, 0, uiItems[0]);
+  if (uiScreen == UI_TIP)
+    u8g.drawStr(54, 0, ActiveTip.name);
+  u8g.drawStr(0, 16 * (uiArrow + 1), ">");
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    uint8_t drawnumber = uiSelected + i + 1 - uiArrow;
+    if (drawnumber < uiNumberOfItems)
+      u8g.drawStr(12, 16 * (i + 1), uiItems[drawnumber]);
+  }
+}
+
+// opens a message screen which is closed by pressing the button
+void MessageScreen(const MessageLine *lines, uint8_t numberOfLines)
+{
+  uiMessage = lines;
+  uiNumberOfItems = numberOfLines;
+  UIOpen(UI_MESSAGE);
+}
+
+void DrawMessageScreen()
+{
+  u8g.setFont(u8g_font_9x15);
+  u8g.setFontPosTop();
+  for (uint8_t i = 0; i < uiNumberOfItems; i++)
+  {
+    u8g.setCursor(0, i * 16);
+    u8g.print(reinterpret_cast<const __FlashStringHelper *>(uiMessage[i]));
+  }
+}
+
+// opens the input value screen; the rotary encoder has to be set before
+void InputScreen(const char *Items[])
+{
+  uiItems = Items;
+  UIOpen(UI_INPUT);
+}
+
+// draws the input value screen
+void DrawInputScreen()
+{
+  uint16_t value = getRotary();
+  u8g.setFont(u8g_font_9x15);
+  u8g.setFontPosTop();
+  u8g.drawStr(0, 0, uiItems[0]);
+  u8g.setCursor(0, 32);
+  u8g.print(">");
+  u8g.setCursor(10, 32);
+  if (value == 0)
+    u8g.print(F("Deactivated"));
+  else
+  {
+    u8g.print(value);
+    u8g.print(" ");
+    u8g.print(uiItems[1]);
+  }
+}
+
+// draws the information display screen; the rotary encoder selects the page
+void DrawInfoScreen()
+{
+  if (getRotary() == 1)
+  {
+    // usage counters of the current tip
+    static const char UsageText[][10] PROGMEM = {"Heater h", "Energy Wh", "At temp h", "Boosts", "Sleeps", "Offs"};
+    u8g.setFont(u8g2_font_5x7_tf);
+    u8g.setFontPosTop();
+    u8g.setCursor(0, 0);
+    u8g.print(F("Usage of tip "));
+    u8g.print(ActiveTip.name);
+    for (uint8_t i = 0; i < USE_COUNTERS; i++)
+    {
+      uint16_t value = ActiveTip.usage[i];
+      u8g.setCursor(0, 8 * (i + 2));
+      u8g.print(reinterpret_cast<const __FlashStringHelper *>(UsageText[i]));
+      u8g.setCursor(60, 8 * (i + 2));
+      if ((i == USE_HEATER) || (i == USE_HOT))
+      {
+        u8g.print(value / 10);
+        u8g.print('.');
+        u8g.print(value % 10);
+      }
+      else
+        u8g.print(value);
+    }
+    return;
+  }
+#if PROFILE_ENABLE
+  if (getRotary() == 2)
+  {
+    // run times in us of the loop stages: minimum, average, maximum
+    static const char StageText[][5] PROGMEM = {"Loop", "Rot", "Slp", "Sen", "ADC", "Thm", "PID", "Scr"};
+    u8g.setFont(u8g2_font_5x7_tf);
+    u8g.setFontPosTop();
+    u8g.setCursor(0, 0);
+    u8g.print(loopRate);
+    u8g.print(F(" Hz   min  avg  max"));
+    for (uint8_t i = 0; i < PROF_STAGES - 1; i++)
+    {
+      ProfileStat *stat = &profile[i + 1];
+      u8g.setCursor(0, 8 * (i + 1));
+      u8g.print(reinterpret_cast<const __FlashStringHelper *>(StageText[i + 1]));
+      if (stat->max)
+      {
+        u8g.setCursor(40, 8 * (i + 1));
+        u8g.print(stat->min);
+        u8g.setCursor(65, 8 * (i + 1));
+        u8g.print(stat->avg / 8);
+        u8g.setCursor(90, 8 * (i + 1));
+        u8g.print(stat->max);
+      }
+    }
+    return;
+  }
+#endif
+  u8g.setFont(u8g_font_9x15);
+  u8g.setFontPosTop();
+  u8g.setCursor(0, 0);
+  u8g.print(F("Firmware: "));
+  u8g.print(VERSION);
+  u8g.setCursor(0, 16);
+  u8g.print(F("Tmp: "));
+  printTenths(ChipTemp);
+  u8g.print(F(" C"));
+  u8g.setCursor(0, 32);
+  u8g.print(F("Vin: "));
+  printTenths((Vin + 50) / 100); // convert mV in V
+  u8g.print(F(" V"));
+  u8g.setCursor(0, 48);
+  u8g.print(F("Vcc:  "));
+  printTenths((Vcc + 50) / 100); // convert mV in V
+  u8g.print(F(" V"));
+}
+
+// opens the change tip screen; inserted is set if called from the main screen (tip change
+// detection, double-click), which the selection returns to
+void ChangeTipScreen(bool inserted)
+{
+  uiTipInserted = inserted;
+  identTip = IDENT_NOTIP;
+  uiSelected = CurrentTip;
+  uiArrow = CurrentTip ? 1 : 0;
+  setRotary(0, NumberOfTips - 1, 1, CurrentTip);
+  UIOpen(UI_CHANGETIP);
+}
+
+// draws the change tip screen
+void DrawChangeTipScreen()
+{
+  u8g.setFont(u8g_font_9x15);
+  u8g.setFontPosTop();
+  u8g.setCursor(0, 0);
+  u8g.print(F("Select Tip"));
+  u8g.drawStr(0, 16 * (uiArrow + 1), ">");
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    uint8_t drawnumber = uiSelected + i - uiArrow;
+    if (drawnumber < NumberOfTips)
+    {
+      TipRecord tip;
+      tipRead(drawnumber, &tip);
+      u8g.drawStr(12, 16 * (i + 1), tip.name);
+    }
+  }
+}
+
+// starts the temperature calibration; the heater is regulated to each
+// calibration point by the main loop while the screen is open
+void CalibrationScreen()
+{
+  inCalibMode = true;
+  inBoostMode = false;
+  handleMoved = true; // wake up from sleep mode
+  uiCalStep = 0;
+  CalibrationStep();
+  UIOpen(UI_CALIBRATION);
+}
+
+// sets up the current calibration step; the heater stays regulated from one setpoint to the next
+void CalibrationStep()
+{
+  SetTemp = CAL_FIRST + (uint16_t)(CAL_LAST - CAL_FIRST) * uiCalStep / (CAL_STEPS - 1);
+  setRotary(100, 500, 1, SetTemp);
+  beepIfWorky = true;
+}
+
+// fits the calibration to the points of the session by least squares; the temperatures at
+// CalADC are the knots of the piecewise linear curve the lookup table is built from, so the
+// stored format and the conversion stay the same. The points are referred to their mean chip
+// temperature, knots without points nearby stay close to the old calibration. Results go to
+// uiCalTemp; returns false if the fitted curve is not rising.
+bool calibrationFit(uint8_t points)
+{
+  int16_t chip = 0; // in 1/10 degrees C
+  for (uint8_t i = 0; i < points; i++)
+    chip += uiCalChip[i] / points;
+  int16_t zero = (CJC_ENABLE ? (chip + 5) / 10 : TEMPZERO) * 16;
+
+  // normal equations of the knots in 1/16 degrees C: every point is the weighted mean of the
+  // knots (or the curve start) of its segment, weights in 1/256 of the segment
+  int32_t matrix[CALPOINTS][CALPOINTS], right[CALPOINTS], knot[CALPOINTS];
+  memset(matrix, 0, sizeof(matrix));
+  for (uint8_t k = 0; k < CALPOINTS; k++)
+  {
+    knot[k] = ActiveTip.cal[k] * 16;
+    matrix[k][k] = CAL_PRIOR;
+    right[k] = CAL_PRIOR * knot[k];
+  }
+  for (uint8_t i = 0; i < points; i++)
+  {
+    uint16_t adc = min(uiCalADC[i], (2 * CalADC[CALPOINTS - 1] - CalADC[CALPOINTS - 2]) * 64);
+    uint8_t segment = 0;
+    while ((segment < CALPOINTS - 1) && (adc >= CalADC[segment] * 64))
+      segment++;
+    int32_t x0 = segment ? CalADC[segment - 1] * 64 : 0;
+    int32_t upper = (adc - x0) * 256 / (CalADC[segment] * 64 - x0);
+    int32_t lower = 256 - upper;
+    int32_t target = uiCalMeasured[i] * 16;
+    if (CJC_ENABLE)
+      target -= (uiCalChip[i] - chip) * 16 / 10; // as measured at the mean chip temperature
+    target *= 256;
+    if (segment)
+    {
+      matrix[segment - 1][segment - 1] += lower * lower / 256;
+      matrix[segment - 1][segment] += lower * upper / 256;
+      matrix[segment][segment - 1] += lower * upper / 256;
+      right[segment - 1] += lower * target / 256;
+    }
+    else
+      target -= lower * zero;
+    matrix[segment][segment] += upper * upper / 256;
+    right[segment] += upper * target / 256;
+  }
+
+  // Gauss-Seidel iterations, converging for the positive definite matrix
+  for (uint8_t n = 0; n < 32; n++)
+    for (uint8_t k = 0; k < CALPOINTS; k++)
+    {
+      int32_t sum = right[k];
+      for (uint8_t j = 0; j < CALPOINTS; j++)
+        if (j != k)
+          sum -= matrix[k][j] * knot[j];
+      knot[k] = sum / matrix[k][k];
+    }
+
+  bool valid = (knot[0] > zero) && (knot[CALPOINTS - 1] < 1024 * 16);
+  for (uint8_t k = 0; k < CALPOINTS; k++)
+  {
+    uiCalTemp[k] = (knot[k] + 8) / 16;
+    valid &= !k || (uiCalTemp[k - 1] + 10 < uiCalTemp[k]);
+  }
+  uiCalTemp[CALPOINTS] = (chip + 5) / 10;
+  return valid;
+}
+
+// draws the temperature calibration screen
+void DrawCalibrationScreen()
+{
+  u8g.setFont(u8g_font_9x15);
+  u8g.setFontPosTop();
+  u8g.setCursor(0, 0);
+  u8g.print(F("Calibration"));
+  u8g.setCursor(0, 16);
+  u8g.print(F("Step: "));
+  u8g.print(uiCalStep + 1);
+  u8g.print(F(" of "));
+  u8g.print(CAL_STEPS);
+  if (isWorky)
+  {
+    u8g.setCursor(0, 32);
+    u8g.print(F("Set measured"));
+    u8g.setCursor(0, 48);
+    u8g.print(F("temp: "));
+    u8g.print(getRotary());
+  }
+  else
+  {
+    u8g.setCursor(0, 32);
+    u8g.print(F("ADC:  "));
+    u8g.print(RawTemp >> 6);
+    u8g.setCursor(0, 48);
+    u8g.print(F("Please wait..."));
+  }
+}
+
+// starts the PID auto-tune of the current tip at the working temperature; the relay
+// oscillation is run by the control loop while the screen is open
+void AutoTuneScreen()
+{
+  inBoostMode = false;
+  handleMoved = true; // wake up from sleep mode
+  tuneState = TUNE_RUNNING;
+  tuneCycle = 0;
+  tuneHeating = true;
+  tuneTicks = tuneTotal = tunePeriods = tuneAmps = 0;
+  tuneMax = tuneMin = CurrentTemp;
+  ctrl.SetMode(MANUAL);
+  inTuneMode = true;
+  UIOpen(UI_AUTOTUNE);
+}
+
+// draws the PID auto-tune screen
+void DrawAutoTuneScreen()
+{
+  u8g.setFont(u8g_font_9x15);
+  u8g.setFontPosTop();
+  u8g.setCursor(0, 0);
+  u8g.print(F("Auto Tune"));
+  if (tuneState == TUNE_DONE)
+  {
+    static const char GainText[][4] PROGMEM = {"Kp:", "Ki:", "Kd:"};
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      u8g.setCursor(0, 16 * (i + 1));
+      u8g.print(reinterpret_cast<const __FlashStringHelper *>(GainText[i]));
+      u8g.setCursor(36, 16 * (i + 1));
+      printTenths(((uint32_t)tuneGains[i] * 10 + 128) >> 8);
+    }
+    return;
+  }
+  u8g.setCursor(0, 16);
+  u8g.print(F("Cycle: "));
+  u8g.print(min(tuneCycle, (uint8_t)(TUNE_SKIP + TUNE_CYCLES)));
+  u8g.print(F(" of "));
+  u8g.print(TUNE_SKIP + TUNE_CYCLES);
+  u8g.setCursor(0, 32);
+  u8g.print(F("Temp: "));
+  u8g.print(CurrentTemp);
+  u8g.setCursor(0, 48);
+  u8g.print(tuneState == TUNE_RUNNING ? F("Press to abort") : F("Press button"));
+}
+
+// starts the benchmark; a warm tip cools down first for a cold start
+void BenchmarkScreen()
+{
+  SetTemp = DefaultTemp; // restored when the setup menu is left
+  memset(benchResults, 0, sizeof(benchResults));
+  benchCompleted = 0;
+  inBenchMode = true;
+  BenchmarkPhase((CurrentTemp < BENCH_COLD) ? BENCH_HEAT : BENCH_COOL);
+  UIOpen(UI_BENCHMARK);
+}
+
+// draws the benchmark screen: the running phase, then the results of all phases
+void DrawBenchmarkScreen()
+{
+  static const char PhaseText[][6] PROGMEM = {"Cool", "Heat", "Boost", "Load", "Sleep"};
+  if (inBenchMode)
+  {
+    u8g.setFont(u8g_font_9x15);
+    u8g.setFontPosTop();
+    u8g.setCursor(0, 0);
+    u8g.print(F("Benchmark"));
+    u8g.setCursor(0, 16);
+    u8g.print(F("Phase: "));
+    u8g.print(reinterpret_cast<const __FlashStringHelper *>(PhaseText[benchPhase]));
+    u8g.setCursor(0, 32);
+    u8g.print(F("Temp: "));
+    u8g.print(CurrentTemp);
+    u8g.setCursor(0, 48);
+    u8g.print(F("Set:  "));
+    u8g.print(benchTarget);
+    return;
+  }
+  u8g.setFont(u8g2_font_5x7_tf);
+  u8g.setFontPosTop();
+  u8g.setCursor(0, 0);
+  u8g.print(F("Phase reach over rip duty"));
+  for (uint8_t i = 0; i < BENCH_PHASES; i++)
+  {
+    BenchResult *result = &benchResults[i];
+    u8g.setCursor(0, 10 * (i + 1));
+    u8g.print(reinterpret_cast<const __FlashStringHelper *>(PhaseText[i + BENCH_HEAT]));
+    u8g.setCursor(30, 10 * (i + 1));
+    if (i >= benchCompleted)
+    {
+      u8g.print('-');
+      continue;
+    }
+    printTenths(result->reach);
+    u8g.setCursor(60, 10 * (i + 1));
+    u8g.print(result->overshoot);
+    u8g.setCursor(85, 10 * (i + 1));
+    u8g.print(result->ripple);
+    u8g.setCursor(105, 10 * (i + 1));
+    u8g.print(result->duty);
+    u8g.print('%');
+  }
+}
+
+// opens the input tip name screen
+void InputNameScreen()
+{
+  uiDigit = 0;
+  setRotary(31, 96, 1, 65);
+  UIOpen(UI_INPUTNAME);
+}
+
+// draws the input tip name screen
+void DrawInputNameScreen()
+{
+  u8g.setFont(u8g_font_9x15);
+  u8g.setFontPosTop();
+  u8g.setCursor(0, 0);
+  u8g.print(F("Enter Tip Name"));
+  u8g.setCursor(9 * uiDigit, 48);
+  u8g.print(char(94));
+  u8g.setCursor(0, 32);
+  for (uint8_t i = 0; i < uiDigit; i++)
+    u8g.print(ActiveTip.name[i]);
+  u8g.setCursor(9 * uiDigit, 32);
+  u8g.print(char(getRotary()));
+}
+
+// delete tip screen
+void DeleteTipScreen()
+{
+  if (NumberOfTips == 1)
+    MessageScreen(DeleteMessage, NUMITEMS(DeleteMessage));
+  else
+    MenuOpen(UI_SURE, 0);
+}
+
+// add new tip screen
+void AddTipScreen()
+{
+  if (NumberOfTips < TIPMAX)
+  {
+    tipSave(); // the menu only acts while the EEPROM is idle
+    CurrentTip = NumberOfTips++;
+    serialLoading = false; // the staged tips are behind the table
+    setDefaultTip();
+    buildTempTable();
+    InputNameScreen();
   }
+  else
+    MessageScreen(MaxTipMessage, NUMITEMS(MaxTipMessage));
 }
 
-// temperature settings screen
-void TempScreen()
+// counts the heater use of the current tip every control period: the heater on time at full
+// power and the energy from the PWM value and the measured supply voltage, and the time at
+// temperature; changed counters are stored at least every USAGE_FLUSH minutes
+void USAGECheck()
 {
-  uint8_t selection = 0;
-  bool repeat = true;
-  while (repeat)
+  uint8_t pwm = HEATER_PWM;
+  usageHeater += pwm;
+  if (usageHeater >= USAGE_TENTH * 255)
   {
-    selection = MenuScreen(TempItems, sizeof(TempItems), selection);
-    switch (selection)
-    {
-    case 0:
-      setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, DefaultTemp);
-      DefaultTemp = InputScreen(DefaultTempItems);
-      break;
-    case 1:
-      setRotary(20, 200, TEMP_STEP, SleepTemp);
-      SleepTemp = InputScreen(SleepTempItems);
-      break;
-    case 2:
-      setRotary(10, 100, TEMP_STEP, BoostTemp);
-      BoostTemp = InputScreen(BoostTempItems);
-      break;
-    default:
-      repeat = false;
-      break;
-    }
+    usageHeater -= USAGE_TENTH * 255;
+    usageCount(USE_HEATER);
+  }
+  if (pwm)
+    usageEnergy += getHeaterPower(Vin, CurrentTemp) * pwm / 255;
+  if (usageEnergy >= USAGE_WH)
+  {
+    usageEnergy -= USAGE_WH;
+    usageCount(USE_ENERGY);
   }
+  if (TipIsPresent && (CurrentTemp >= USAGE_HOT) && (++usageHot >= USAGE_TENTH))
+  {
+    usageHot = 0;
+    usageCount(USE_HOT);
+  }
+  if (usageChanged && (millis() - usageMillis >= USAGE_FLUSH * 60000UL))
+    usageStore();
 }
 
-// timer settings screen
-void TimerScreen()
+// counts an event or a unit of a usage counter of the current tip
+void usageCount(uint8_t counter)
 {
-  uint8_t selection = 0;
-  bool repeat = true;
-  while (repeat)
-  {
-    selection = MenuScreen(TimerItems, sizeof(TimerItems), selection);
-    switch (selection)
-    {
-    case 0:
-      setRotary(0, 30, 1, time2sleep);
-      time2sleep = InputScreen(SleepTimerItems);
-      break;
-    case 1:
-      setRotary(0, 60, 5, time2off);
-      time2off = InputScreen(OffTimerItems);
-      break;
-    case 2:
-      setRotary(0, 180, 10, timeOfBoost);
-      timeOfBoost = InputScreen(BoostTimerItems);
-      break;
-    default:
-      repeat = false;
-      break;
-    }
-  }
+  if (ActiveTip.usage[counter] < 0xFFFF)
+    ActiveTip.usage[counter]++;
+  usageChanged = true;
+}
+
+// rounds the remainders of the counters into the current tip and clears them, as the next
+// tip starts counting from zero
+void usageRound()
+{
+  if (usageHeater >= USAGE_TENTH * 255 / 2)
+    usageCount(USE_HEATER);
+  if (usageEnergy >= USAGE_WH / 2)
+    usageCount(USE_ENERGY);
+  if (usageHot >= USAGE_TENTH / 2)
+    usageCount(USE_HOT);
+  usageHeater = usageEnergy = 0;
+  usageHot = 0;
+}
+
+// stores the usage counters of the current tip with the settings
+void usageStore()
+{
+  usageChanged = false;
+  usageMillis = millis();
+  updateEEPROM();
 }
 
-// menu screen
-uint8_t MenuScreen(const char *Items[], uint8_t numberOfItems, uint8_t selected)
+// sends a telemetry frame at TELEMETRY_RATE; the frame is only handed to the interrupt
+// driven UART buffer if it fits completely, otherwise it is dropped (see the frame counter)
+void TELEMETRYCheck()
 {
-  bool isTipScreen = (Items[0] == TipItems[0]);
-  uint8_t lastselected = selected;
-  int8_t arrow = 0;
-  if (selected)
-    arrow = 1;
-  numberOfItems >>= 1;
-  setRotary(0, numberOfItems - 2, 1, selected);
-  bool lastbutton = (!digitalRead(BUTTON_PIN));
+  if (!TELEMETRY_RATE || !telemetryEnable || (++telemetryTicks < CONTROL_RATE / TELEMETRY_RATE))
+    return;
+  if (serialLength || serialList) // do not split a command line or a listing
+    return;
+  telemetryTicks = 0;
 
-  do
+  uint8_t frame[TELEMETRY_SIZE];
+  uint8_t *p = frame;
+  uint32_t now = millis();
+  uint16_t raw = getFrameADC();
+  uint8_t flags = inSleepMode | (inOffMode << 1) | (inBoostMode << 2) | (isWorky << 3) |
+                  (TipIsPresent << 4) | (inCalibMode << 5) | (inTuneMode << 6) | ((loadBurst != 0) << 7);
+  *p++ = TELEMETRY_TYPE;
+  *p++ = telemetrySeq++;
+  for (uint8_t i = 0; i < 4; i++)
+    *p++ = now >> (8 * i); // timestamp in ms
+  *p++ = raw;              // unfiltered ADC value in 1/64
+  *p++ = raw >> 8;
+  *p++ = CurrentTemp;      // degrees C
+  *p++ = CurrentTemp >> 8;
+  *p++ = Setpoint;         // degrees C
+  *p++ = Setpoint >> 8;
+  *p++ = Output;           // PID output (0: full power, 255: heater off)
+  *p++ = Vin;              // mV
+  *p++ = Vin >> 8;
+  *p++ = ChipTemp;         // 1/10 degrees C
+  *p++ = ChipTemp >> 8;
+  *p++ = flags;
+  *p++ = ControlType;
+  uint8_t crc = 0;
+  for (uint8_t *q = frame; q < p; q++)
+    crc = _crc8_ccitt_update(crc, *q);
+  *p = crc;
+
+  uint8_t encoded[TELEMETRY_SIZE + 3];
+  encoded[0] = 0; // leading delimiter, ends any text output in front of the frame
+  uint8_t length = cobsEncode(frame, TELEMETRY_SIZE, encoded + 1) + 1;
+  encoded[length++] = 0; // frame delimiter
+  if (Serial.availableForWrite() >= length)
+    Serial.write(encoded, length);
+}
+
+// encodes a block of up to 254 bytes with Consistent Overhead Byte Stuffing, so that the
+// result contains no zeros; returns the encoded length (one byte more than the block)
+uint8_t cobsEncode(const uint8_t *src, uint8_t length, uint8_t *dst)
+{
+  uint8_t code = 1;
+  uint8_t codePos = 0;
+  uint8_t pos = 1;
+  for (uint8_t i = 0; i < length; i++)
   {
-    selected = getRotary();
-    arrow = constrain(arrow + selected - lastselected, 0, 2);
-    lastselected = selected;
-    u8g.firstPage();
-    do
+    if (src[i])
     {
-      u8g.setFont(u8g_font_9x15);
-      u8g.setFontPosTop();
-      u8g.drawStr(0, 0, Items[0]);
-      if (isTipScreen)
-        u8g.drawStr(54, 0, TipName[CurrentTip]);
-      u8g.drawStr(0, 16 * (arrow + 1), ">");
-      for (uint8_t i = 0; i < 3; i++)
-      {
-        uint8_t drawnumber = selected + i + 1 - arrow;
-        if (drawnumber < numberOfItems)
-          u8g.drawStr(12, 16 * (i + 1), Items[selected + i + 1 - arrow]);
-      }
-    } while (u8g.nextPage());
-    if (lastbutton && digitalRead(BUTTON_PIN))
+      dst[pos++] = src[i];
+      code++;
+    }
+    else
     {
-      delay(10);
-      lastbutton = false;
+      dst[codePos] = code;
+      codePos = pos++;
+      code = 1;
     }
-  } while (digitalRead(BUTTON_PIN) || lastbutton);
+  }
+  dst[codePos] = code;
+  return pos;
+}
 
-  beep();
-  return selected;
+// prints the result of a benchmark phase as: bench <phase> <reach in 1/10 s> <overshoot> <ripple> <duty>
+// or "bench <phase> -" if the phase was not completed
+void benchmarkPrint(uint8_t phase)
+{
+  static const char PhaseNames[][6] PROGMEM = {"heat", "boost", "load", "sleep"};
+  BenchResult *result = &benchResults[phase];
+  Serial.print(F("bench "));
+  Serial.print(reinterpret_cast<const __FlashStringHelper *>(PhaseNames[phase]));
+  if (phase >= benchCompleted)
+  {
+    Serial.println(F(" -"));
+    return;
+  }
+  Serial.print(' ');
+  Serial.print(result->reach);
+  Serial.print(' ');
+  Serial.print(result->overshoot);
+  Serial.print(' ');
+  Serial.print(result->ripple);
+  Serial.print(' ');
+  Serial.println(result->duty);
 }
 
-void MessageScreen(const char *Items[], uint8_t numberOfItems)
+// receives the command lines on the UART; parses a bounded number of bytes and executes at most
+// one command or listing line per pass, only when the TX buffer can take the answer without waiting
+void SERIALCheck()
 {
-  bool lastbutton = (!digitalRead(BUTTON_PIN));
-  u8g.firstPage();
-  do
+  if ((Serial.availableForWrite() < SERIAL_LINE) || tipBusy()) // commands may switch or stage tips
+    return;
+  if (serialList)
   {
-    u8g.setFont(u8g_font_9x15);
-    u8g.setFontPosTop();
-    for (uint8_t i = 0; i < numberOfItems; i++)
-      u8g.drawStr(0, i * 16, Items[i]);
-  } while (u8g.nextPage());
-  do
+    serialListNext();
+    return;
+  }
+  for (uint8_t i = 0; (i < SERIAL_CHUNK) && Serial.available(); i++)
   {
-    if (lastbutton && digitalRead(BUTTON_PIN))
+    char c = Serial.read();
+    if ((c == '\n') || (c == '\r'))
     {
-      delay(10);
-      lastbutton = false;
+      serialLine[serialLength] = 0;
+      if (serialOverflow)
+        Serial.println(F("err length"));
+      else if (serialLength)
+        serialCommand();
+      serialLength = 0;
+      serialOverflow = false;
+      return;
     }
-  } while (digitalRead(BUTTON_PIN) || lastbutton);
-  beep();
+    if (serialLength < SERIAL_LINE - 1)
+      serialLine[serialLength++] = c;
+    else
+      serialOverflow = true;
+  }
 }
 
-// input value screen
-uint16_t InputScreen(const char *Items[])
+// executes the received command line
+void serialCommand()
 {
-  uint16_t value;
-  bool lastbutton = (!digitalRead(BUTTON_PIN));
-
-  do
+  char *line = serialLine;
+  char *command = serialToken(&line);
+  if (!strcmp_P(command, PSTR("get")))
   {
-    value = getRotary();
-    u8g.firstPage();
-    do
-    {
-      u8g.setFont(u8g_font_9x15);
-      u8g.setFontPosTop();
-      u8g.drawStr(0, 0, Items[0]);
-      u8g.setCursor(0, 32);
-      u8g.print(">");
-      u8g.setCursor(10, 32);
-      if (value == 0)
-        u8g.print(F("Deactivated"));
-      else
-      {
-        u8g.print(value);
-        u8g.print(" ");
-        u8g.print(Items[1]);
-      }
-    } while (u8g.nextPage());
-    if (lastbutton && digitalRead(BUTTON_PIN))
+    char *name = serialToken(&line);
+    int8_t index = serialFind(name);
+    if (!*name)
+      serialList = LIST_SETTINGS;
+    else if (index < 0)
+      Serial.println(F("err name"));
+    else
+      serialPrintSetting(index);
+  }
+  else if (!strcmp_P(command, PSTR("set")))
+  {
+    int8_t index = serialFind(serialToken(&line));
+    uint16_t value;
+    if (index < 0)
+      Serial.println(F("err name"));
+    else if (!serialNumber(serialToken(&line), &value))
+      Serial.println(F("err value"));
+    else if (uiScreen != UI_MAIN)
+      Serial.println(F("err busy"));
+    else
+      serialSet(index, value);
+  }
+  else if (!strcmp_P(command, PSTR("tips")))
+    serialList = LIST_TIPS;
+  else if (!strcmp_P(command, PSTR("bench")))
+    serialList = LIST_BENCH;
+  else if (!strcmp_P(command, PSTR("usage")))
+    serialList = LIST_USAGE;
+  else if (!strcmp_P(command, PSTR("load")))
+  {
+    serialLoading = true;
+    serialTipCount = 0;
+    Serial.println(F("ok"));
+  }
+  else if (!strcmp_P(command, PSTR("tip")))
+    serialLoadTip(line);
+  else if (!strcmp_P(command, PSTR("commit")))
+    serialCommit(line);
+  else if (!strcmp_P(command, PSTR("abort")))
+  {
+    serialLoading = false;
+    Serial.println(F("ok"));
+  }
+  else if (!strcmp_P(command, PSTR("telemetry")))
+  {
+    char *state = serialToken(&line);
+    if (!strcmp_P(state, PSTR("on")) || !strcmp_P(state, PSTR("off")))
     {
-      delay(10);
-      lastbutton = false;
+      telemetryEnable = !strcmp_P(state, PSTR("on"));
+      telemetryTicks = 0;
+      Serial.println(F("ok"));
     }
-  } while (digitalRead(BUTTON_PIN) || lastbutton);
-
-  beep();
-  return value;
+    else
+      Serial.println(F("err value"));
+  }
+#if PROFILE_ENABLE
+  else if (!strcmp_P(command, PSTR("profile")))
+    serialList = LIST_PROFILE;
+#endif
+  else
+    Serial.println(F("err command"));
+  serialIndex = 0;
 }
 
-// information display screen
-void InfoScreen()
+// sends the next line of the current listing, "ok" after the last one
+void serialListNext()
 {
-  bool lastbutton = (!digitalRead(BUTTON_PIN));
-
-  do
+  uint8_t index = serialIndex++;
+  switch (serialList)
   {
-    Vcc = getVCC();                 // read input voltage
-    float fVcc = (float)Vcc / 1000; // convert mV in V
-    Vin = getVIN();                 // read supply voltage
-    float fVin = (float)Vin / 1000; // convert mv in V
-    float fTmp = getChipTemp();     // read cold junction temperature
-    u8g.firstPage();
-    do
+  case LIST_SETTINGS:
+    if (index < NUMITEMS(SerialSettings))
     {
-      u8g.setFont(u8g_font_9x15);
-      u8g.setFontPosTop();
-      u8g.setCursor(0, 0);
-      u8g.print(F("Firmware: "));
-      u8g.print(VERSION);
-      u8g.setCursor(0, 16);
-      u8g.print(F("Tmp: "));
-      u8g.print(fTmp, 1);
-      u8g.print(F(" C"));
-      u8g.setCursor(0, 32);
-      u8g.print(F("Vin: "));
-      u8g.print(fVin, 1);
-      u8g.print(F(" V"));
-      u8g.setCursor(0, 48);
-      u8g.print(F("Vcc:  "));
-      u8g.print(fVcc, 1);
-      u8g.print(F(" V"));
-    } while (u8g.nextPage());
-    if (lastbutton && digitalRead(BUTTON_PIN))
+      serialPrintSetting(index);
+      return;
+    }
+    break;
+  case LIST_TIPS:
+    if (index < NumberOfTips)
     {
-      delay(10);
-      lastbutton = false;
+      serialPrintTip(index);
+      return;
     }
-  } while (digitalRead(BUTTON_PIN) || lastbutton);
-
-  beep();
-}
-
-// change tip screen
-void ChangeTipScreen()
-{
-  uint8_t selected = CurrentTip;
-  uint8_t lastselected = selected;
-  int8_t arrow = 0;
-  if (selected)
-    arrow = 1;
-  setRotary(0, NumberOfTips - 1, 1, selected);
-  bool lastbutton = (!digitalRead(BUTTON_PIN));
-
-  do
-  {
-    selected = getRotary();
-    arrow = constrain(arrow + selected - lastselected, 0, 2);
-    lastselected = selected;
-    u8g.firstPage();
-    do
+    break;
+  case LIST_PROFILE:
+    if (index <= PROF_STAGES)
     {
-      u8g.setFont(u8g_font_9x15);
-      u8g.setFontPosTop();
-      u8g.setCursor(0, 0);
-      u8g.print(F("Select Tip"));
-      u8g.drawStr(0, 16 * (arrow + 1), ">");
-      for (uint8_t i = 0; i < 3; i++)
-      {
-        uint8_t drawnumber = selected + i - arrow;
-        if (drawnumber < NumberOfTips)
-          u8g.drawStr(12, 16 * (i + 1), TipName[selected + i - arrow]);
-      }
-    } while (u8g.nextPage());
-    if (lastbutton && digitalRead(BUTTON_PIN))
+      profileDump(index);
+      return;
+    }
+    profileReset();
+    break;
+  case LIST_BENCH:
+    if (index < BENCH_PHASES)
+    {
+      benchmarkPrint(index);
+      return;
+    }
+    break;
+  case LIST_USAGE:
+    if (index < NumberOfTips)
     {
-      delay(10);
-      lastbutton = false;
+      serialPrintUsage(index);
+      return;
     }
-  } while (digitalRead(BUTTON_PIN) || lastbutton);
+    break;
+  }
+  serialList = LIST_NONE;
+  Serial.println(F("ok"));
+}
 
-  beep();
-  CurrentTip = selected;
+// returns the next token of a command line, separated by spaces or enclosed in quotes
+char *serialToken(char **line)
+{
+  char *p = *line;
+  char end = ' ';
+  while (*p == ' ')
+    p++;
+  if (*p == '"')
+  {
+    end = '"';
+    p++;
+  }
+  char *token = p;
+  while (*p && (*p != end))
+    p++;
+  if (*p)
+    *p++ = 0;
+  *line = p;
+  return token;
 }
 
-// temperature calibration screen
-void CalibrationScreen()
+// converts a decimal token; returns false if it is no number up to 65535
+bool serialNumber(const char *token, uint16_t *value)
 {
-  uint16_t CalTempNew[4];
-  for (uint8_t CalStep = 0; CalStep < 3; CalStep++)
+  uint32_t result = 0;
+  if (!*token)
+    return false;
+  for (; *token; token++)
   {
-    SetTemp = CalTemp[CurrentTip][CalStep];
-    setRotary(100, 500, 1, SetTemp);
-    beepIfWorky = true;
-    bool lastbutton = (!digitalRead(BUTTON_PIN));
+    if ((*token < '0') || (*token > '9'))
+      return false;
+    result = result * 10 + (*token - '0');
+    if (result > 0xFFFF)
+      return false;
+  }
+  *value = result;
+  return true;
+}
 
-    do
-    {
-      SENSORCheck(); // reads temperature and vibration switch of the iron
-      Thermostat();  // heater control
+// returns the index of the named setting, -1 if unknown
+int8_t serialFind(const char *name)
+{
+  for (uint8_t i = 0; i < NUMITEMS(SerialSettings); i++)
+    if (!strcmp_P(name, SerialSettings[i].name))
+      return i;
+  return -1;
+}
 
-      u8g.firstPage();
-      do
-      {
-        u8g.setFont(u8g_font_9x15);
-        u8g.setFontPosTop();
-        u8g.setCursor(0, 0);
-        u8g.print(F("Calibration"));
-        u8g.setCursor(0, 16);
-        u8g.print(F("Step: "));
-        u8g.print(CalStep + 1);
-        u8g.print(" of 3");
-        if (isWorky)
-        {
-          u8g.setCursor(0, 32);
-          u8g.print(F("Set measured"));
-          u8g.setCursor(0, 48);
-          u8g.print(F("temp: "));
-          u8g.print(getRotary());
-        }
-        else
-        {
-          u8g.setCursor(0, 32);
-          u8g.print(F("ADC:  "));
-          u8g.print(uint16_t(RawTemp));
-          u8g.setCursor(0, 48);
-          u8g.print(F("Please wait..."));
-        }
-      } while (u8g.nextPage());
-      if (lastbutton && digitalRead(BUTTON_PIN))
-      {
-        delay(10);
-        lastbutton = false;
-      }
-    } while (digitalRead(BUTTON_PIN) || lastbutton);
+// copies a setting from the table and returns the address of its value
+uint8_t *serialSetting(uint8_t index, SerialSetting *setting)
+{
+  memcpy_P(setting, &SerialSettings[index], sizeof(SerialSetting));
+  return (uint8_t *)setting->data;
+}
 
-    CalTempNew[CalStep] = getRotary();
-    beep();
-    delay(10);
+// prints a setting as: <name> <value>
+void serialPrintSetting(uint8_t index)
+{
+  SerialSetting setting;
+  uint16_t value = 0;
+  uint8_t *data = serialSetting(index, &setting);
+  memcpy(&value, data, setting.size);
+  Serial.print(setting.name);
+  Serial.print(' ');
+  Serial.println(value);
+}
+
+// changes a setting and takes the actions the setup menu would take
+void serialSet(uint8_t index, uint16_t value)
+{
+  SerialSetting setting;
+  uint8_t *data = serialSetting(index, &setting);
+  if ((value < setting.min) || (value > setting.max) || ((setting.action == SET_TIP) && (value >= NumberOfTips)))
+  {
+    Serial.println(F("err range"));
+    return;
+  }
+  if (setting.action == SET_TIP)
+    tipSelect(value); // commands wait while the EEPROM is written
+  else
+    memcpy(data, &value, setting.size);
+  switch (setting.action)
+  {
+  case SET_TEMP:
+    setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, value); // the main screen takes SetTemp from the encoder
+    handleMoved = true;                              // reset all timers
+    break;
+  case SET_FLIP:
+    SetFlip();
+    updateEEPROM();
+    break;
+  case SET_TIP:
+    RawTemp = getTipADC(); // restart temp smooth algorithm
+    handleMoved = true;
+    updateEEPROM();
+    break;
+  default:
+    updateEEPROM();
+    break;
   }
+  Serial.println(F("ok"));
+}
 
-  analogWrite(CONTROL_PIN, HEATER_OFF); // shut off heater
-  delayMicroseconds(TIME2SETTLE);       // wait for voltage to settle
-  CalTempNew[3] = getChipTemp();        // read chip temperature
-  if ((CalTempNew[0] + 10 < CalTempNew[1]) && (CalTempNew[1] + 10 < CalTempNew[2]))
+// prints a tip as: tip <index> "<name>" <temperatures at CalADC> <chip temp> <Kp> <Ki> <Kd>
+void serialPrintTip(uint8_t index)
+{
+  TipRecord tip;
+  tipRead(index, &tip);
+  Serial.print(F("tip "));
+  Serial.print(index);
+  Serial.print(F(" \""));
+  Serial.print(tip.name);
+  Serial.print('"');
+  for (uint8_t i = 0; i < CALPOINTS + 1; i++)
   {
-    if (MenuScreen(StoreItems, sizeof(StoreItems), 0))
-    {
-      for (uint8_t i = 0; i < 4; i++)
-        CalTemp[CurrentTip][i] = CalTempNew[i];
-    }
+    Serial.print(' ');
+    Serial.print(tip.cal[i]);
+  }
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    Serial.print(' ');
+    Serial.print(tip.gains[i]);
   }
+  Serial.println();
 }
 
-// input tip name screen
-void InputNameScreen()
+// prints the usage counters of a tip as: usage <index> "<name>" <heater on time in 1/10 h> <energy in Wh>
+// <time at temperature in 1/10 h> <boosts> <sleeps> <offs>
+void serialPrintUsage(uint8_t index)
 {
-  uint8_t value;
+  TipRecord tip;
+  tipRead(index, &tip);
+  Serial.print(F("usage "));
+  Serial.print(index);
+  Serial.print(F(" \""));
+  Serial.print(tip.name);
+  Serial.print('"');
+  for (uint8_t i = 0; i < USE_COUNTERS; i++)
+  {
+    Serial.print(' ');
+    Serial.print(tip.usage[i]);
+  }
+  Serial.println();
+}
 
-  for (uint8_t digit = 0; digit < (TIPNAMELENGTH - 1); digit++)
+// stages a tip of an upload transaction (same format as the listing) in the free catalogue
+// slot behind the table of the tips received before
+void serialLoadTip(char *line)
+{
+  TipRecord tip = {};
+  uint16_t index;
+  bool valid = serialLoading && serialNumber(serialToken(&line), &index) && (index == serialTipCount);
+  if (valid && (serialTipCount >= TIPMAX - NumberOfTips))
   {
-    bool lastbutton = (!digitalRead(BUTTON_PIN));
-    setRotary(31, 96, 1, 65);
-    do
-    {
-      value = getRotary();
-      if (value == 31)
-      {
-        value = 95;
-        setRotary(31, 96, 1, 95);
-      }
-      if (value == 96)
-      {
-        value = 32;
-        setRotary(31, 96, 1, 32);
-      }
-      u8g.firstPage();
-      do
-      {
-        u8g.setFont(u8g_font_9x15);
-        u8g.setFontPosTop();
-        u8g.setCursor(0, 0);
-        u8g.print(F("Enter Tip Name"));
-        u8g.setCursor(9 * digit, 48);
-        u8g.print(char(94));
-        u8g.setCursor(0, 32);
-        for (uint8_t i = 0; i < digit; i++)
-          u8g.print(TipName[CurrentTip][i]);
-        u8g.setCursor(9 * digit, 32);
-        u8g.print(char(value));
-      } while (u8g.nextPage());
-      if (lastbutton && digitalRead(BUTTON_PIN))
-      {
-        delay(10);
-        lastbutton = false;
-      }
-    } while (digitalRead(BUTTON_PIN) || lastbutton);
-    TipName[CurrentTip][digit] = value;
-    beep();
-    delay(10);
+    Serial.println(F("err full"));
+    return;
+  }
+  char *name = serialToken(&line);
+  valid &= *name && (strlen(name) < TIPNAMELENGTH);
+  for (char *c = name; valid && *c; c++)
+    valid = (*c >= ' ') && (*c <= '_'); // 6-bit character set of the catalogue
+  if (valid)
+    strncpy(tip.name, name, TIPNAMELENGTH);
+  for (uint8_t i = 0; valid && (i < CALPOINTS + 1); i++)
+    valid = serialNumber(serialToken(&line), &tip.cal[i]);
+  valid &= (tip.cal[0] < 1024) && (tip.cal[CALPOINTS] < 64);
+  for (uint8_t i = 1; valid && (i < CALPOINTS); i++)
+    valid = (tip.cal[i - 1] + 10 < tip.cal[i]) && (tip.cal[i] - tip.cal[i - 1] < 512); // fits the packed rise
+  for (uint8_t i = 0; valid && (i < 3); i++)
+    valid = serialNumber(serialToken(&line), &tip.gains[i]);
+  if (!valid || *serialToken(&line))
+  {
+    Serial.println(F("err tip"));
+    return;
   }
-  TipName[CurrentTip][TIPNAMELENGTH - 1] = 0;
-  return;
+  tipPack(&tip, tipWrite); // thermal model is learned again
+  tipStage(tipAddr(NumberOfTips + serialTipCount++), TIP_RECORD);
+  Serial.println(F("ok"));
 }
 
-// delete tip screen
-void DeleteTipScreen()
+// replaces the tip table by the staged tips and selects the given tip; the table moves on to
+// the staged slots with the next settings record
+void serialCommit(char *line)
 {
-  if (NumberOfTips == 1)
+  uint16_t current;
+  if (!serialLoading || !serialNumber(serialToken(&line), &current) || (current >= serialTipCount))
   {
-    MessageScreen(DeleteMessage, sizeof(DeleteMessage));
+    Serial.println(F("err tip"));
+    return;
   }
-  else if (MenuScreen(SureItems, sizeof(SureItems), 0))
+  if (uiScreen != UI_MAIN)
   {
-    if (CurrentTip == (NumberOfTips - 1))
-    {
-      CurrentTip--;
-    }
-    else
-    {
-      for (uint8_t i = CurrentTip; i < (NumberOfTips - 1); i++)
-      {
-        for (uint8_t j = 0; j < TIPNAMELENGTH; j++)
-          TipName[i][j] = TipName[i + 1][j];
-        for (uint8_t j = 0; j < 4; j++)
-          CalTemp[i][j] = CalTemp[i + 1][j];
-      }
-    }
-    NumberOfTips--;
+    Serial.println(F("err busy"));
+    return;
   }
+  TipBase = (TipBase + NumberOfTips) % TIPMAX;
+  NumberOfTips = serialTipCount;
+  CurrentTip = current;
+  usageRound(); // the remainders of the replaced tip are dropped
+  tipLoad(current, &ActiveTip);
+  serialLoading = false;
+  buildTempTable();
+  RawTemp = getTipADC(); // restart temp smooth algorithm
+  handleMoved = true;    // reset all timers
+  updateEEPROM();
+  Serial.println(F("ok"));
 }
 
-// add new tip screen
-void AddTipScreen()
+// adds a run time measurement to the statistics of a stage
+void profileAdd(uint8_t stage, uint32_t time)
 {
-  if (NumberOfTips < TIPMAX)
+  ProfileStat *stat = &profile[stage];
+  uint16_t us = min(time, 0xFFFFUL);
+  if (!stat->max)
   {
-    CurrentTip = NumberOfTips++;
-    InputNameScreen();
-    CalTemp[CurrentTip][0] = TEMP200;
-    CalTemp[CurrentTip][1] = TEMP280;
-    CalTemp[CurrentTip][2] = TEMP360;
-    CalTemp[CurrentTip][3] = TEMPCHP;
+    stat->min = us;
+    stat->avg = (uint32_t)us * 8;
   }
-  else
-    MessageScreen(MaxTipMessage, sizeof(MaxTipMessage));
+  stat->min = min(stat->min, us);
+  stat->max = max(stat->max, max(us, (uint16_t)1));
+  stat->avg += us - (int32_t)(stat->avg / 8);
 }
 
-// average several ADC readings in sleep mode to denoise
-uint16_t denoiseAnalog(byte port)
+// resets minimum, maximum and average of all stages
+void profileReset()
 {
-  uint16_t result = 0;
-  ADCSRA |= bit(ADEN) | bit(ADIF); // enable ADC, turn off any pending interrupt
-  if (port >= A0)
-    port -= A0;                       // set port and
-  ADMUX = (0x0F & port) | bit(REFS0); // reference to AVcc
-  set_sleep_mode(SLEEP_MODE_ADC);     // sleep during sample for noise reduction
-  for (uint8_t i = 0; i < 32; i++)
-  {               // get 32 readings
-    sleep_mode(); // go to sleep while taking ADC sample
-    while (bitRead(ADCSRA, ADSC))
-      ;            // make sure sampling is completed
-    result += ADC; // add them up
+  for (uint8_t i = 0; i < PROF_STAGES; i++)
+    profile[i].max = 0;
+}
+
+// counts the loop passes per second
+void PROFILECheck()
+{
+  if (millis() - profileMillis >= 1000)
+  {
+    profileMillis += 1000;
+    loopRate = loopCount;
+    loopCount = 0;
   }
-  bitClear(ADCSRA, ADEN); // disable ADC
-  return (result >> 5);   // devide by 32 and return value
 }
 
-// get internal temperature by reading ADC channel 8 against 1.1V reference
-double getChipTemp()
+// prints a line of the run time listing on serial: the loop rate, then stage, min, avg and max in us
+void profileDump(uint8_t line)
 {
-  uint16_t result = 0;
+  static const char StageNames[][11] PROGMEM = {"loop", "rotary", "sleep", "sensor", "denoise",
+                                                "thermostat", "compute", "mainscreen"};
+  if (!line)
+  {
+    Serial.print(F("loop rate: "));
+    Serial.print(loopRate);
+    Serial.println(F(" Hz"));
+    return;
+  }
+  ProfileStat *stat = &profile[line - 1];
+  Serial.print(reinterpret_cast<const __FlashStringHelper *>(StageNames[line - 1]));
+  Serial.print('\t');
+  Serial.print(stat->min);
+  Serial.print('\t');
+  Serial.print(stat->avg / 8);
+  Serial.print('\t');
+  Serial.println(stat->max);
+}
+
+// average several ADC readings of the given channel to denoise
+uint16_t denoiseAnalog(byte channel)
+{
+  ADCLock();
+  ADCSRA |= bit(ADEN) | bit(ADIF);       // enable ADC, turn off any pending interrupt
+  ADMUX = (0x0F & channel) | bit(REFS0); // set channel and reference to AVcc
+  uint16_t result = adcConvert(32);      // get 32 readings
+  ADCUnlock();
+  return (result >> 5); // devide by 32 and return value
+}
+
+// get internal temperature in 1/10 degrees C by reading ADC channel 8 against 1.1V reference
+int16_t getChipTemp()
+{
+  ADCLock();
   ADCSRA |= bit(ADEN) | bit(ADIF);             // enable ADC, turn off any pending interrupt
   ADMUX = bit(REFS1) | bit(REFS0) | bit(MUX3); // set reference and mux
   delay(20);                                   // wait for voltages to settle
-  set_sleep_mode(SLEEP_MODE_ADC);              // sleep during sample for noise reduction
-  for (uint8_t i = 0; i < 32; i++)
-  {               // get 32 readings
-    sleep_mode(); // go to sleep while taking ADC sample
-    while (bitRead(ADCSRA, ADSC))
-      ;            // make sure sampling is completed
-    result += ADC; // add them up
-  }
-  bitClear(ADCSRA, ADEN);          // disable ADC
-  result >>= 2;                    // devide by 4
-  return ((result - 2594) / 9.76); // calculate internal temperature in degrees C
+  uint16_t result = adcConvert(CHIP_SAMPLES);
+  ADCUnlock();
+  return chipConvert(result);
+}
+
+// converts a sum of CHIP_SAMPLES readings of the internal temperature sensor to 1/10 degrees C
+int16_t chipConvert(uint16_t sum)
+{
+  sum /= CHIP_SAMPLES / 8;                     // 8 times the mean
+  return (((int32_t)sum - 2594) * 1000 / 976); // calculate internal temperature
 }
 
 // get input voltage in mV by reading 1.1V reference against AVcc
 uint16_t getVCC()
 {
-  uint16_t result = 0;
+  ADCLock();
   ADCSRA |= bit(ADEN) | bit(ADIF); // enable ADC, turn off any pending interrupt
   // set Vcc measurement against 1.1V reference
   ADMUX = bit(REFS0) | bit(MUX3) | bit(MUX2) | bit(MUX1);
-  delay(1);                       // wait for voltages to settle
-  set_sleep_mode(SLEEP_MODE_ADC); // sleep during sample for noise reduction
-  for (uint8_t i = 0; i < 16; i++)
-  {               // get 16 readings
-    sleep_mode(); // go to sleep while taking ADC sample
-    while (bitRead(ADCSRA, ADSC))
-      ;            // make sure sampling is completed
-    result += ADC; // add them up
-  }
-  bitClear(ADCSRA, ADEN);     // disable ADC
+  delay(1);                         // wait for voltages to settle
+  uint16_t result = adcConvert(16); // get 16 readings
+  ADCUnlock();
   result >>= 4;               // devide by 16
   return (1125300L / result); // 1125300 = 1.1 * 1023 * 1000
 }
 
+// returns the sum of the given number of conversions of the selected channel; the CPU idles
+// during a conversion, while the timers, the UART and the TWI keep running (the noise reduction
+// mode would stop them and stretch the PWM frame)
+uint16_t adcConvert(uint8_t count)
+{
+  uint16_t result = 0;
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  for (uint8_t i = 0; i < count; i++)
+  {
+    ADCSRA |= bit(ADSC); // start the conversion
+    while (bitRead(ADCSRA, ADSC))
+      sleep_mode(); // any interrupt wakes up, the ADC one when the conversion is done
+    result += ADC;
+  }
+  return result;
+}
+
 // get supply voltage in mV
 uint16_t getVIN()
 {
-  long result;
-  result = denoiseAnalog(VIN_PIN); // read supply voltage via voltage divider
-  return (result * Vcc / 179.474); // 179.474 = 1023 * R13 / (R12 + R13)
+  uint32_t result;
+  PROFILE(PROF_DENOISE, result = denoiseAnalog(Hardware::vinChannel)); // read supply voltage via voltage divider
+  return (result * Vcc * 100 / 17947); // 179.47 = 1023 * R13 / (R12 + R13)
+}
+
+// waits for a running measurement window to finish and keeps the ADC
+// interrupt from starting a new one while blocking readings are taken
+void ADCLock()
+{
+  adcLock = true;
+  while (adcState != ADC_IDLE)
+    ;
+}
+
+// releases the ADC for the measurement windows; the tip temperature channel
+// is selected right away to give the reference voltage time to settle
+void ADCUnlock()
+{
+  ADMUX = Hardware::sensorChannel | bit(REFS0);
+  adcLock = false;
+}
+
+// returns the tip temperature ADC value averaged over the ring buffer in 1/64
+uint16_t getTipADC()
+{
+  noInterrupts();
+  uint16_t result = adcValue;
+  interrupts();
+  return ((uint32_t)result * 64 / ADC_RING);
+}
+
+// returns the unfiltered ADC value of the last measurement window in 1/64
+uint16_t getFrameADC()
+{
+  noInterrupts();
+  uint16_t result = adcLatest;
+  uint8_t samples = adcLatestSamples;
+  interrupts();
+  return result * (64 / samples); // up to 16 * 1023 * 4, fits
+}
+
+// ADC interrupt service routine; collects the samples of a measurement window
+// into the ring buffer and publishes the result when the window is complete
+ISR(ADC_vect)
+{
+  uint16_t value = ADC;
+  if (adcState == ADC_SENSOR)
+  {
+    adcFrame += value;
+    adcSum += value - adcRing[adcHead];
+    adcRing[adcHead] = value;
+    adcHead = (adcHead + 1) & (ADC_RING - 1);
+    if (++adcCount < adcSamples)
+    {
+      ADCSRA |= bit(ADSC); // start next conversion
+      return;
+    }
+    adcCount = 0;
+    adcValue = adcSum;
+    adcLatest = adcFrame;
+    adcLatestSamples = adcSamples;
+    if (!adcReady)
+      adcMissed = 0;
+    else if (adcMissed < 255)
+      adcMissed++; // the previous sample was not taken in time
+    adcReady = true;
+    if (chipRequest)
+    { // the chip temperature follows in the heater on time, the first conversions wait for
+      // the 1.1V reference to settle; it is done before the next frame starts
+      chipRequest = false;
+      chipSum = 0;
+      adcState = ADC_CHIP;
+      ADMUX = bit(REFS1) | bit(REFS0) | bit(MUX3);
+      ADCSRA |= bit(ADSC);
+      return;
+    }
+  }
+  else if (adcState == ADC_VIN)
+  {
+    vinSum += value;
+    if (++adcCount < ADC_SAMPLES)
+    {
+      ADCSRA |= bit(ADSC); // start next conversion
+      return;
+    }
+    adcCount = 0;
+    vinReady = true;
+  }
+  else if (adcState == ADC_CHIP)
+  {
+    if (adcCount >= CHIP_SETTLE)
+      chipSum += value;
+    if (++adcCount < CHIP_SETTLE + CHIP_SAMPLES)
+    {
+      ADCSRA |= bit(ADSC); // start next conversion
+      return;
+    }
+    adcCount = 0;
+    chipReady = true;
+    ADMUX = Hardware::sensorChannel | bit(REFS0); // back to AVcc for the next window
+  }
+  else
+    return; // conversion of a blocking reading
+
+  adcState = ADC_IDLE;
+}
+
+// Timer1 overflow interrupt service routine; a new PWM frame starts with the heater
+// switched off by the hardware, Vin is sampled every now and then while the OpAmp settles
+ISR(TIMER1_OVF_vect)
+{
+  adcSamples = adcNextSamples; // window length belonging to the compare value loaded at TOP
+  if (!adcLock && (adcState == ADC_IDLE) && !vinCounter--)
+  {
+    vinCounter = VIN_INTERVAL - 1;
+    vinSum = 0;
+    adcState = ADC_VIN;
+    ADMUX = Hardware::vinChannel | bit(REFS0);
+    ADCSRA |= bit(ADEN) | bit(ADSC);
+  }
+}
+
+// Timer1 compare match B interrupt service routine; the OpAmp output has settled,
+// sample the tip temperature in the remaining heater off time of the window
+ISR(TIMER1_COMPB_vect)
+{
+  if (adcLock || (adcState != ADC_IDLE))
+    return; // skip this frame
+  adcCount = 0;
+  adcFrame = 0;
+  adcState = ADC_SENSOR;
+  ADMUX = Hardware::sensorChannel | bit(REFS0);
+  ADCSRA |= bit(ADEN) | bit(ADSC);
 }
 
-// ADC interrupt service routine
-EMPTY_INTERRUPT(ADC_vect); // nothing to be done here
+// Timer2 compare match interrupt service routine (1ms scheduler tick, buzzer patterns, encoder switch)
+ISR(TIMER2_COMPA_vect)
+{
+  if (++displayTicks >= DISPLAY_PERIOD)
+  {
+    displayTicks = 0;
+    displayDue = true;
+  }
+  if (beepTicks && !--beepTicks)
+    beepNext();
+  buttonTick();
+}
 
-// Pin change interrupt service routine for rotary encoder
+// Pin change interrupt service routine for rotary encoder and handle vibration switch
 ISR(PCINT0_vect)
 {
-  uint8_t a = PINB & 1;
-  uint8_t b = PIND >> 7 & 1;
+  uint8_t a = Hardware::Rotary2::read();
+  uint8_t b = Hardware::Rotary1::read();
+  uint8_t d = Hardware::Switch::read();
+
+  if (d != d0)
+  { // handle was moved
+    d0 = d;
+    handleMoved = true;
+  }
 
   if (a != a0)
   { // A changed
@@ -1250,13 +4554,19 @@ ISR(PCINT0_vect)
     if (b != b0)
     { // B changed
       b0 = b;
-      count = constrain(count + ((a == b) ? countStep : -countStep), countMin, countMax);
-      if (ROTARY_TYPE && ((a == b) != ab0))
-      {
-        count = constrain(count + ((a == b) ? countStep : -countStep), countMin, countMax);
-      }
+      int8_t delta = (a == b) ? 1 : -1;
+      if (Hardware::rotaryShift && ((a == b) != ab0))
+        delta *= 2;
       ab0 = (a == b);
+      inputPush(INPUT_TURN, delta);
+      encoderTicks = 0;
       handleMoved = true;
     }
   }
 }
+
+// Pin change interrupt service routine for the encoder switch, only enabled while powered down
+ISR(PCINT2_vect)
+{
+  handleMoved = true; // wake up the station
+}
@@ -0,0 +1,118 @@
+// Arduino core mock for the native environment: time comes from the simulation,
+// digital inputs from simPins, the serial port reads simSerialIn and writes simSerialOut
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "Simulation.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define A0 14
+#define A1 15
+#define SDA 18
+#define SCL 19
+#define DEC 10
+#define HEX 16
+#define SERIAL_TX_BUFFER_SIZE 64
+
+#define bit(b) (1UL << (b))
+#define bitRead(value, b) (((value) >> (b)) & 1)
+#define bitSet(value, b) ((value) |= bit(b))
+#define bitClear(value, b) ((value) &= ~bit(b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+#define noInterrupts() cli()
+#define interrupts() sei()
+
+inline uint32_t millis() { return simMicros / 1000; }
+inline uint32_t micros() { return simMicros; }
+inline void delay(uint32_t ms) { simMicros += ms * 1000; }
+inline void delayMicroseconds(uint16_t us) { simMicros += us; }
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t pin) { return simPins[pin]; }
+inline long map(long x, long inMin, long inMax, long outMin, long outMax)
+{
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t *buffer, size_t size)
+  {
+    for (size_t i = 0; i < size; i++)
+      write(buffer[i]);
+    return size;
+  }
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(const __FlashStringHelper *s) { return print((const char *)s); }
+  size_t print(char c) { return write(c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC)
+  {
+    char s[24];
+    snprintf(s, sizeof(s), (base == HEX) ? "%lX" : "%ld", n);
+    return print(s);
+  }
+  size_t print(unsigned long n, int base = DEC)
+  {
+    char s[24];
+    snprintf(s, sizeof(s), (base == HEX) ? "%lX" : "%lu", n);
+    return print(s);
+  }
+  size_t print(double n, int digits = 2)
+  {
+    char s[32];
+    snprintf(s, sizeof(s), "%.*f", digits, n);
+    return print(s);
+  }
+  template <typename T>
+  size_t println(T value) { return print(value) + println(); }
+  size_t println() { return print("\r\n"); }
+};
+
+static const char *simSerialIn = "";      // bytes still to be received
+static uint8_t simSerialOut[2048];        // bytes sent (the TX buffer is always empty)
+static uint16_t simSerialLength;
+
+class HardwareSerial : public Print
+{
+public:
+  void begin(unsigned long) {}
+  int available() { return strlen(simSerialIn); }
+  int read() { return *simSerialIn ? (uint8_t)*simSerialIn++ : -1; }
+  int availableForWrite() { return SERIAL_TX_BUFFER_SIZE - 1; }
+  size_t write(uint8_t c)
+  {
+    if (simSerialLength < sizeof(simSerialOut))
+      simSerialOut[simSerialLength++] = c;
+    return 1;
+  }
+  using Print::write;
+};
+static HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,17 @@
+// Arduino EEPROM library mock for the native environment
+
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <avr/eeprom.h>
+
+struct EEPROMClass
+{
+  uint8_t read(int index) { return eeprom_read_byte((const uint8_t *)(uintptr_t)index); }
+  void write(int index, uint8_t value) { eeprom_write_byte((uint8_t *)(uintptr_t)index, value); }
+  void update(int index, uint8_t value) { eeprom_update_byte((uint8_t *)(uintptr_t)index, value); }
+  uint16_t length() { return E2END + 1; }
+};
+static EEPROMClass EEPROM;
+
+#endif
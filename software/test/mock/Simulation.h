@@ -0,0 +1,12 @@
+// Hooks between the hardware mocks and the simulation (native environment only)
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdint.h>
+
+extern uint32_t simMicros;       // simulated time in us, drives millis() and micros()
+extern uint8_t simPins[32];      // levels of the digital inputs
+uint16_t simADC(uint8_t channel); // result of an ADC conversion of the given mux channel
+
+#endif
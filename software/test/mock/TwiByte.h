@@ -0,0 +1,22 @@
+// TwiByte mock for the native environment: the display transport is always idle
+
+#ifndef TWIBYTE_H
+#define TWIBYTE_H
+
+#include <U8g2lib.h>
+
+inline bool twiIdle() { return true; }
+
+class U8G2_SSD1306_128X64_NONAME_1_TWI : public U8G2
+{
+public:
+  U8G2_SSD1306_128X64_NONAME_1_TWI(const u8g2_cb_t *) {}
+};
+
+class U8G2_SH1106_128X64_NONAME_1_TWI : public U8G2
+{
+public:
+  U8G2_SH1106_128X64_NONAME_1_TWI(const u8g2_cb_t *) {}
+};
+
+#endif
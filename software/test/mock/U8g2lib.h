@@ -0,0 +1,50 @@
+// U8g2 mock for the native environment: drawing is discarded
+
+#ifndef U8G2LIB_H
+#define U8G2LIB_H
+
+#include <Arduino.h>
+
+typedef struct u8g2_struct
+{
+  uint8_t tileRow;
+} u8g2_t;
+typedef struct
+{
+  uint8_t rotation;
+} u8g2_cb_t;
+static const u8g2_cb_t u8g2_cb_r0 = {0}, u8g2_cb_r2 = {2};
+#define U8G2_R0 (&u8g2_cb_r0)
+#define U8G2_R2 (&u8g2_cb_r2)
+
+static const uint8_t u8g_font_9x15[1] = {0}, u8g2_font_6x10_tf[1] = {0}, u8g2_font_5x7_tf[1] = {0},
+                     u8g2_font_freedoomr25_tn[1] = {0}, u8g2_font_fub42_tn[1] = {0};
+
+class U8G2 : public Print
+{
+public:
+  bool begin() { return true; }
+  void setFont(const uint8_t *) {}
+  void setFontPosTop() {}
+  void setCursor(int, int) {}
+  void drawStr(int, int, const char *) {}
+  void drawBox(int, int, int, int) {}
+  void drawFrame(int, int, int, int) {}
+  void drawHLine(int, int, int) {}
+  void setDrawColor(uint8_t) {}
+  void setDisplayRotation(const u8g2_cb_t *) {}
+  void setFlipMode(uint8_t) {}
+  void setContrast(uint8_t) {}
+  void setPowerSave(uint8_t) {}
+  void clearBuffer() {}
+  void sendBuffer() {}
+  void setBufferCurrTileRow(uint8_t row) { u8g2.tileRow = row; }
+  void firstPage() {}
+  uint8_t nextPage() { return 0; }
+  u8g2_t *getU8g2() { return &u8g2; }
+
+protected:
+  u8g2_t u8g2;
+};
+
+#endif
@@ -0,0 +1,35 @@
+// EEPROM mock for the native environment: writes complete immediately, a power failure
+// can be simulated by limiting the number of writes (once they are used up, any access jumps
+// to simPowerFail if set, as the code would never get past it)
+
+#ifndef AVR_EEPROM_H
+#define AVR_EEPROM_H
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <avr/io.h>
+
+static uint8_t simEEPROM[E2END + 1] = {0xFF};
+static int32_t simEEPROMWrites = -1; // writes until the EEPROM stays busy (-1: unlimited)
+static jmp_buf *simPowerFail;        // return point once simEEPROMWrites are used up
+inline void simPowerCheck()
+{
+  if (!simEEPROMWrites && simPowerFail)
+    longjmp(*simPowerFail, 1);
+}
+inline bool eeprom_is_ready()
+{
+  simPowerCheck();
+  return simEEPROMWrites != 0;
+}
+inline uint8_t eeprom_read_byte(const uint8_t *address) { return simEEPROM[(uintptr_t)address & E2END]; }
+inline void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+  simPowerCheck();
+  simEEPROM[(uintptr_t)address & E2END] = value;
+  if (simEEPROMWrites > 0)
+    simEEPROMWrites--;
+}
+inline void eeprom_write_byte(uint8_t *address, uint8_t value) { eeprom_update_byte(address, value); }
+
+#endif
@@ -0,0 +1,12 @@
+// Interrupt mock for the native environment: ISRs become plain functions the simulation calls
+
+#ifndef AVR_INTERRUPT_H
+#define AVR_INTERRUPT_H
+
+#define ISR(vector, ...) extern "C" void vector(void)
+#define EMPTY_INTERRUPT(vector) extern "C" void vector(void) {}
+#define ISR_NOBLOCK
+inline void cli() {}
+inline void sei() {}
+
+#endif
@@ -0,0 +1,44 @@
+// ATmega328P register mock for the native environment; the registers are plain
+// variables, the simulation reads and writes them like the hardware would
+
+#ifndef AVR_IO_H
+#define AVR_IO_H
+
+#include <stdint.h>
+
+#define E2END 0x3FF
+
+#define R8(name) static volatile uint8_t name;
+#define R16(name) static volatile uint16_t name;
+R8(ADCSRA) R8(ADCSRB) R8(ADMUX) R16(ADC) R8(DIDR0)
+R8(TCCR0A) R8(TCCR0B) R8(TIMSK0) R8(TIFR0) R8(OCR0A) R8(OCR0B) R8(TCNT0)
+R8(TCCR1A) R8(TCCR1B) R8(TIMSK1) R8(TIFR1) R16(OCR1A) R16(OCR1B) R16(ICR1) R16(TCNT1)
+R8(TCCR2A) R8(TCCR2B) R8(TIMSK2) R8(TIFR2) R8(OCR2A) R8(OCR2B) R8(TCNT2)
+R8(PINB) R8(PINC) R8(PIND) R8(PORTB) R8(PORTC) R8(PORTD) R8(DDRB) R8(DDRC) R8(DDRD)
+R8(PCMSK0) R8(PCMSK1) R8(PCMSK2) R8(PCICR) R8(PCIFR)
+R8(MCUSR) R8(WDTCSR) R8(SMCR) R8(PRR)
+R8(TWBR) R8(TWSR) R8(TWCR) R8(TWDR)
+#undef R8
+#undef R16
+
+enum { ADPS0, ADPS1, ADPS2, ADIE, ADIF, ADATE, ADSC, ADEN };
+enum { MUX0, MUX1, MUX2, MUX3, ADLAR = 5, REFS0, REFS1 };
+enum { WGM10, WGM11, COM1B0 = 4, COM1B1, COM1A0, COM1A1 };
+enum { CS10, CS11, CS12, WGM12, WGM13 };
+enum { TOIE1, OCIE1A, OCIE1B };
+enum { TOV1, OCF1A, OCF1B };
+enum { WGM20, WGM21, COM2B0 = 4, COM2B1, COM2A0, COM2A1 };
+enum { CS20, CS21, CS22, WGM22 };
+enum { TOIE2, OCIE2A, OCIE2B };
+enum { WGM00, WGM01, COM0B0 = 4, COM0B1, COM0A0, COM0A1 };
+enum { PCINT0, PCINT1, PCINT2, PCINT3, PCINT4, PCINT5, PCINT6, PCINT7 };
+enum { PCINT16, PCINT17, PCINT18, PCINT19, PCINT20, PCINT21, PCINT22, PCINT23 };
+enum { PCIE0, PCIE1, PCIE2 };
+enum { PCIF0, PCIF1, PCIF2 };
+enum { PORF, EXTRF, BORF, WDRF };
+enum { WDP0, WDP1, WDP2, WDE, WDCE, WDP3, WDIE, WDIF };
+enum { TWIE, TWEN = 2, TWWC, TWSTO, TWSTA, TWEA, TWINT };
+
+#define _BV(b) (1u << (b))
+
+#endif
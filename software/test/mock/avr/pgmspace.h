@@ -0,0 +1,18 @@
+// Program memory mock for the native environment: flash and RAM share the address space
+
+#ifndef AVR_PGMSPACE_H
+#define AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_ptr(address) (*(void *const *)(address))
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+#define strcpy_P strcpy
+
+#endif
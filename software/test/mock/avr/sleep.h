@@ -0,0 +1,32 @@
+// Sleep mock for the native environment: sleep_mode() completes a started conversion
+// with the simulated reading, like the ADC interrupt would wake up the CPU
+
+#ifndef AVR_SLEEP_H
+#define AVR_SLEEP_H
+
+#include <avr/io.h>
+#include "Simulation.h"
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+#define SLEEP_MODE_PWR_DOWN 2
+#define SLEEP_MODE_PWR_SAVE 3
+
+static uint8_t simSleepMode;
+inline void set_sleep_mode(uint8_t mode) { simSleepMode = mode; }
+inline void sleep_enable() {}
+inline void sleep_disable() {}
+inline void sleep_cpu() { simMicros += 1000; }
+inline void sleep_mode()
+{
+  if (!(ADCSRA & (1 << ADSC)))
+  {
+    sleep_cpu();
+    return;
+  }
+  simMicros += 104;
+  ADC = simADC(ADMUX & 0x0F);
+  ADCSRA &= ~(1 << ADSC);
+}
+
+#endif
@@ -0,0 +1,24 @@
+// Watchdog mock for the native environment: the simulation keeps the timeout of the
+// running watchdog and counts the resets of its timer
+
+#ifndef AVR_WDT_H
+#define AVR_WDT_H
+
+#include <stdint.h>
+
+#define WDTO_15MS 0
+#define WDTO_30MS 1
+#define WDTO_60MS 2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+
+static int8_t simWatchdog = -1; // timeout of the running watchdog (-1: stopped)
+static uint32_t simWatchdogResets;
+inline void wdt_enable(uint8_t timeout) { simWatchdog = timeout; }
+inline void wdt_disable() { simWatchdog = -1; }
+inline void wdt_reset() { simWatchdogResets++; }
+
+#endif
@@ -0,0 +1,1296 @@
+// Simulation and benchmark of the heater control (PlatformIO native environment)
+//
+// The unmodified firmware is compiled against the hardware mocks in test/mock and
+// runs on a simulated Hakko T12 tip. For every PWM frame the Timer1 and ADC
+// interrupts are called the way the hardware calls them, the heater on time of the
+// frame (taken from OCR1A) goes into the thermal model of the tip, and the control
+// tasks of the main loop run on the new sample. There is no display, UI or EEPROM
+// traffic in the loop, only the control path.
+//
+// For every control type the test prints rise time, overshoot, settling time,
+// temperature drop and recovery time under a soldering load, the error caused by
+// single measurement spikes and the host run time of one control iteration
+// (SENSORCheck() and Thermostat()). Run times on the ATmega are profiled by the
+// firmware itself (PROFILE_ENABLE). The sleep and off timers are checked as well, and
+// the tip catalogue in the EEPROM with its migration from the old records, the
+// identification of an inserted tip, the calibration fit, the faults detected by the
+// health monitor and the usage counters of the tips.
+//
+// Run: pio test -e native -v
+
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include "main.cpp"
+
+// Thermal model of the tip: the heater node carries the thermocouple, the tip node
+// loses heat to the ambient and to the load (a pad being soldered)
+#define SIM_AMBIENT 21.0  // ambient temperature in degrees C (TEMPZERO of the default calibration)
+#define SIM_VIN 24.0      // supply voltage in V
+#define SIM_C_HEATER 0.8  // heat capacity of heater and sensor in J/K
+#define SIM_C_TIP 1.6     // heat capacity of the tip in J/K
+#define SIM_G_INNER 0.5   // heat conductance from heater to tip in W/K
+#define SIM_G_LOSS (TIP_LOSS / 1000.0) // heat loss of the idle tip in W/K
+#define SIM_G_LOAD 0.1    // heat conductance into a large pad in W/K
+#define SIM_NOISE 2       // ADC noise in counts (uniform, +/-)
+#define SIM_SPIKE 60      // ADC counts of an injected measurement spike
+#define SIM_STEP_US 1000  // integration step of the thermal model in us
+
+// Benchmark values
+#define BENCH_SETPOINT 320 // working temperature of the step response
+#define BENCH_BAND 3       // settling band around the setpoint in degrees C
+#define BENCH_STEP 30      // duration of the step response in seconds
+#define BENCH_LOAD 10      // duration of the soldering load in seconds
+#define BENCH_SPIKES 5     // number of spikes injected one second apart
+#define BENCH_WAKE 60      // max time from wake-up to working temperature in seconds
+
+uint32_t simMicros;
+uint8_t simPins[32];
+
+static double simHeater, simTip; // node temperatures in degrees C
+static double simLoad;           // heat conductance of the current load in W/K
+static bool simSpike;            // add a spike to the sensor samples of the next window
+static bool simRemoved;          // tip pulled out, the sensor input is open
+static bool simOpen, simStuck;   // heater broken, MOSFET stuck on
+static bool simStalled;          // the main loop does not take the samples
+static uint32_t simBusy;         // time in us the ADC converted in the last frame
+static double simVin;            // supply voltage in V
+static double simEnergy, simOnTime; // heater energy in J and on time in s
+static uint32_t simRandom = 1;
+static uint32_t simIterations;
+static double simRunTime, simRunMax; // host run time per control iteration in ns
+
+// ADC value of a sensor temperature: inverse of the default calibration curve
+static double simSensorADC(double temp)
+{
+  static const double adc[] = {0, 200, 280, 360};
+  static const double cal[] = {SIM_AMBIENT, TEMP200, TEMP280, TEMP360};
+  uint8_t i = 1;
+  while ((i < 3) && (temp > cal[i]))
+    i++;
+  return adc[i - 1] + (temp - cal[i - 1]) * (adc[i] - adc[i - 1]) / (cal[i] - cal[i - 1]);
+}
+
+// sensor temperature of an ADC value: the default calibration curve
+static double simSensorTemp(double adc)
+{
+  static const double adcs[] = {0, 200, 280, 360};
+  static const double cal[] = {SIM_AMBIENT, TEMP200, TEMP280, TEMP360};
+  uint8_t i = 1;
+  while ((i < 3) && (adc > adcs[i]))
+    i++;
+  return cal[i - 1] + (adc - adcs[i - 1]) * (cal[i] - cal[i - 1]) / (adcs[i] - adcs[i - 1]);
+}
+
+uint16_t simADC(uint8_t channel)
+{
+  simRandom = simRandom * 1103515245 + 12345;
+  int16_t noise = (int16_t)((simRandom >> 16) % (2 * SIM_NOISE + 1)) - SIM_NOISE;
+  double value;
+  switch (channel)
+  {
+  case Hardware::sensorChannel:
+    value = simRemoved ? 1023 : simSensorADC(simHeater) + noise + (simSpike ? SIM_SPIKE : 0);
+    break;
+  case Hardware::vinChannel:
+    value = simVin * 1000 * 17947 / 100 / Vcc; // divider as in getVIN()
+    break;
+  case 0x08: // chip temperature sensor, inverse of getChipTemp()
+    value = ((SIM_AMBIENT + 5) * 9.76 + 2594) / 8;
+    break;
+  case 0x0E: // 1.1V reference against AVcc of 5V
+    value = 1.1 * 1023 / 5;
+    break;
+  default:
+    value = 0;
+  }
+  return constrain(value, 0, 1023);
+}
+
+// advances the thermal model by the given time with the heater on or off
+static void simPlant(uint32_t us, bool heating)
+{
+  for (; us; us -= min(us, (uint32_t)SIM_STEP_US))
+  {
+    double dt = min(us, (uint32_t)SIM_STEP_US) / 1e6;
+    double res = HEATER_RES / 1000.0 * (1 + HEATER_TC / 10000.0 * (simHeater - 20));
+    double power = (simStuck || (heating && !simOpen)) ? simVin * simVin / res : 0;
+    simEnergy += power * dt;
+    simOnTime += power ? dt : 0;
+    double inner = SIM_G_INNER * (simHeater - simTip);
+    double loss = (SIM_G_LOSS + simLoad) * (simTip - SIM_AMBIENT);
+    simHeater += (power - inner) / SIM_C_HEATER * dt;
+    simTip += (inner - loss) / SIM_C_TIP * dt;
+  }
+}
+
+// completes the ADC conversions started by the interrupts, one sample every 104us
+static void simConversions()
+{
+  while (ADCSRA & bit(ADSC))
+  {
+    ADCSRA &= ~bit(ADSC);
+    simMicros += 104;
+    ADC = simADC(ADMUX & 0x0F);
+    ADC_vect();
+  }
+}
+
+// updates the port input registers from the simulated pins and runs the pin change
+// interrupts of the changed pins that are enabled
+static void simPorts(bool interrupt)
+{
+  uint8_t pind = 0, pinb = 0;
+  for (uint8_t i = 0; i < 8; i++)
+    pind |= (simPins[i] ? 1 : 0) << i;
+  for (uint8_t i = 0; i < 6; i++)
+    pinb |= (simPins[i + 8] ? 1 : 0) << i;
+  uint8_t changedB = (pinb ^ PINB) & PCMSK0, changedD = (pind ^ PIND) & PCMSK2;
+  PINB = pinb;
+  PIND = pind;
+  if (interrupt && changedB && (PCICR & bit(PCIE0)))
+    PCINT0_vect();
+  if (interrupt && changedD && (PCICR & bit(PCIE2)))
+    PCINT2_vect();
+}
+
+// runs one PWM frame: measurement window, control tasks of the main loop, heater on time
+static void simFrame()
+{
+  uint32_t start = simMicros;
+  uint16_t compare = OCR1A; // loaded from the buffer at TOP
+  uint32_t onCounts = (compare < FRAME_COUNTS) ? FRAME_COUNTS - compare : 0;
+  uint32_t frameUs = (uint32_t)FRAME_COUNTS * 16;
+  simPorts(true);
+
+  TIFR1 = 0; // flags are cleared by executing the interrupts
+  TIMER1_OVF_vect();
+  simConversions();
+  simMicros = start + SETTLE_COUNTS * 16;
+  TIMER1_COMPB_vect();
+  simConversions();
+  simBusy = simMicros - start;
+  simSpike = false;
+
+  INPUTCheck();
+  ROTARYCheck();
+  SLEEPCheck();
+  if (adcReady && !simStalled)
+  {
+    adcReady = false;
+    auto begin = std::chrono::steady_clock::now();
+    SENSORCheck();
+    Thermostat();
+    USAGECheck();
+    CJCCheck();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    simRunTime += ns;
+    simRunMax = max(simRunMax, ns);
+    simIterations++;
+  }
+
+  for (uint8_t tick = 0; tick < CONTROL_PERIOD; tick++)
+    TIMER2_COMPA_vect(); // scheduler ticks of the frame
+  simPlant(frameUs - onCounts * 16, false);
+  simPlant(onCounts * 16, true);
+  simMicros = start + frameUs;
+}
+
+// runs the frames of the given time in seconds
+static void simRun(double seconds)
+{
+  for (uint32_t frames = seconds * CONTROL_RATE; frames; frames--)
+    simFrame();
+}
+
+// restarts the firmware with a cold tip and the given control type
+static void simStart(uint8_t controlType)
+{
+  simHeater = simTip = SIM_AMBIENT;
+  simLoad = 0;
+  simRemoved = simOpen = simStuck = simStalled = false;
+  simVin = SIM_VIN;
+  simIterations = 0;
+  simRunTime = simRunMax = 0;
+  memset(simPins, HIGH, sizeof(simPins)); // pull-ups: button released, switch open
+  simPorts(false);
+  memset(simEEPROM, 0xFF, sizeof(simEEPROM));
+
+  ctrl.SetMode(MANUAL);
+  inSleepMode = inOffMode = inBoostMode = inTuneMode = inBenchMode = benchForced = false;
+  loadBurst = loadHoldoff = 0;
+  modelTicks = modelBurst = 0;
+  identState = IDENT_NONE;
+  identTip = IDENT_NOTIP;
+  TipIsPresent = true;
+  faultCode = FAULT_NONE;
+  healthTicks = adcMissed = 0;
+  usageHeater = usageEnergy = usageHot = 0;
+  CurrentTip = 0; // the erased EEPROM is set to the default tip
+  NumberOfTips = 1;
+  adcState = ADC_IDLE;
+  adcReady = vinReady = false;
+  Vin = GAIN_VIN; // until the first reading
+  inputHead = inputTail = buttonBounce = 0;
+  buttonEvent = INPUT_NONE;
+  buttonDown = buttonLong = buttonClicked = buttonSecond = false;
+  uiScreen = UI_MAIN;
+  setup();
+  ControlType = controlType;
+  bootStep = BOOT_DONE;
+}
+
+// Results of a benchmark run
+struct Bench
+{
+  double rise, overshoot, settling; // step response: 10% to 90% in s, degrees C, s into the band
+  double drop, recovery;            // soldering load: max drop in degrees C, s back into the band
+  double spike;                     // max error caused by the spikes in degrees C
+};
+
+static Bench simBench(uint8_t controlType)
+{
+  Bench bench = {};
+  simStart(controlType);
+  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, BENCH_SETPOINT);
+
+  // step response from ambient to the working temperature
+  double low = SIM_AMBIENT + (BENCH_SETPOINT - SIM_AMBIENT) * 0.1;
+  double high = SIM_AMBIENT + (BENCH_SETPOINT - SIM_AMBIENT) * 0.9;
+  double t10 = -1, t90 = -1, outside = 0, peak = 0;
+  for (uint32_t frame = 0; frame < (uint32_t)BENCH_STEP * CONTROL_RATE; frame++)
+  {
+    simFrame();
+    double t = (double)(frame + 1) / CONTROL_RATE;
+    if ((t10 < 0) && (simHeater >= low))
+      t10 = t;
+    if ((t90 < 0) && (simHeater >= high))
+      t90 = t;
+    if (fabs(simHeater - BENCH_SETPOINT) > BENCH_BAND)
+      outside = t;
+    peak = max(peak, simHeater);
+  }
+  bench.rise = (t90 < 0) ? BENCH_STEP : t90 - t10;
+  bench.overshoot = max(peak - BENCH_SETPOINT, 0.0);
+  bench.settling = outside;
+
+  // soldering load on the settled tip
+  double lowest = simHeater;
+  outside = 0;
+  simLoad = SIM_G_LOAD;
+  for (uint32_t frame = 0; frame < (uint32_t)BENCH_LOAD * CONTROL_RATE; frame++)
+  {
+    simFrame();
+    if (fabs(simHeater - BENCH_SETPOINT) > BENCH_BAND)
+      outside = (double)(frame + 1) / CONTROL_RATE;
+    lowest = min(lowest, simHeater);
+  }
+  simLoad = 0;
+  bench.drop = BENCH_SETPOINT - lowest;
+  bench.recovery = outside;
+  simRun(5);
+
+  // single window spikes on the settled tip
+  for (uint8_t i = 0; i < BENCH_SPIKES; i++)
+  {
+    simSpike = true;
+    for (uint8_t frame = 0; frame < CONTROL_RATE; frame++)
+    {
+      simFrame();
+      bench.spike = max(bench.spike, fabs(CurrentTemp - simHeater));
+    }
+  }
+  return bench;
+}
+
+static void printBench(const char *name, const Bench &bench)
+{
+  printf("%-12s rise %5.2fs  overshoot %5.1fC  settling %5.2fs  load drop %5.1fC  recovery %5.2fs  "
+         "spike error %4.1fC  iteration %6.0fns avg %6.0fns max\n",
+         name, bench.rise, bench.overshoot, bench.settling, bench.drop, bench.recovery, bench.spike,
+         simRunTime / max(simIterations, (uint32_t)1), simRunMax);
+}
+
+void test_direct()
+{
+  Bench bench = simBench(CONTROL_DIRECT);
+  printBench("direct", bench);
+  TEST_ASSERT_TRUE_MESSAGE(bench.rise < BENCH_STEP, "working temperature not reached");
+}
+
+void test_pid()
+{
+  Bench bench = simBench(CONTROL_PID);
+  printBench("pid", bench);
+  TEST_ASSERT_TRUE_MESSAGE(bench.settling < BENCH_STEP, "step response does not settle");
+  TEST_ASSERT_TRUE_MESSAGE(bench.overshoot < 15, "overshoot too large");
+  TEST_ASSERT_TRUE_MESSAGE(bench.recovery < BENCH_LOAD, "no recovery under load");
+  TEST_ASSERT_TRUE_MESSAGE(bench.spike < 5, "spikes are not rejected");
+}
+
+void test_load_detect()
+{
+  Bench pid = simBench(CONTROL_PID);
+  Bench bench = simBench(CONTROL_LOAD);
+  printBench("load detect", bench);
+  TEST_ASSERT_TRUE_MESSAGE(bench.settling < BENCH_STEP, "step response does not settle");
+  TEST_ASSERT_TRUE_MESSAGE(bench.drop < pid.drop + 1, "load detection increases the drop");
+}
+
+void test_sleep_timers()
+{
+  simStart(CONTROL_PID);
+  simRun(time2sleep * 60.0 - 1);
+  TEST_ASSERT_FALSE(inSleepMode);
+  simRun(2);
+  TEST_ASSERT_TRUE(inSleepMode);
+  simRun(240); // the tip cools down passively
+  TEST_ASSERT_TRUE_MESSAGE(fabs(simHeater - SleepTemp) < 10, "sleep temperature not reached");
+  simRun((time2off - time2sleep) * 60.0);
+  TEST_ASSERT_TRUE(inOffMode);
+  TEST_ASSERT_EQUAL_UINT8(HEATER_OFF, heaterPWM);
+
+  simPins[Hardware::Switch::number] = LOW; // handle moved
+  simRun(1);
+  TEST_ASSERT_FALSE(inSleepMode);
+  TEST_ASSERT_FALSE(inOffMode);
+}
+
+void test_power_save()
+{
+  simStart(CONTROL_PID);
+  simFrame(); // wake-up of the start
+  inOffMode = inSleepMode = true;
+  for (uint32_t frame = 0; frame < 10UL * CONTROL_RATE; frame++)
+  { // background tasks of the main loop finish the start-up beep, listing and EEPROM record
+    simFrame();
+    DISPLAYUpdate();
+    SERIALCheck();
+    EEPROMCheck();
+  }
+  TEST_ASSERT_EQUAL_UINT8(DISPLAY_OFF, displayPower);
+  POWERCheck();
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(SLEEP_MODE_PWR_DOWN, simSleepMode, "no power-down in off mode");
+  TEST_ASSERT_EQUAL_UINT8(HEATER_COM | bit(WGM11), TCCR1A);
+
+  simPins[Hardware::Button::number] = LOW; // button pressed while powered down
+  PCICR |= bit(PCIE2);
+  simPorts(true);
+  PCICR &= ~bit(PCIE2);
+  simPins[Hardware::Button::number] = HIGH;
+  simPorts(false);
+  simRun(0.2);
+  TEST_ASSERT_FALSE(inOffMode);
+  DISPLAYUpdate();
+  TEST_ASSERT_EQUAL_UINT8(DISPLAY_ON, displayPower);
+  simSleepMode = SLEEP_MODE_IDLE;
+  POWERCheck();
+  TEST_ASSERT_TRUE_MESSAGE(simSleepMode != SLEEP_MODE_PWR_DOWN, "power-down while working");
+}
+
+// runs the scheduler ticks of the given time in ms
+static void simTicks(uint16_t ms)
+{
+  while (ms--)
+    TIMER2_COMPA_vect();
+}
+
+// presses the encoder switch for the given time in ms and releases it
+static void simPress(uint16_t ms)
+{
+  simPins[Hardware::Button::number] = LOW;
+  simPorts(true);
+  simTicks(ms);
+  simPins[Hardware::Button::number] = HIGH;
+  simPorts(true);
+  simTicks(BUTTON_DEBOUNCE);
+}
+
+// turns the rotary encoder by the given steps in the increasing direction, one step per given ms
+static void simTurn(uint8_t steps, uint16_t ms)
+{
+  while (steps--)
+  {
+    simPins[Hardware::Rotary1::number] = !simPins[Hardware::Rotary1::number];
+    simPorts(true);
+    simPins[Hardware::Rotary2::number] = !simPins[Hardware::Rotary2::number];
+    simPorts(true);
+    simTicks(ms);
+  }
+  INPUTCheck();
+}
+
+// takes the queued events on the main screen
+static void simInput()
+{
+  for (uint8_t i = 0; i < INPUT_QUEUE; i++)
+  {
+    INPUTCheck();
+    ROTARYCheck();
+  }
+}
+
+void test_input_events()
+{
+  simStart(CONTROL_PID);
+  simPress(80);
+  simTicks(BUTTON_DOUBLE);
+  simInput();
+  TEST_ASSERT_TRUE_MESSAGE(inBoostMode, "click does not toggle boost mode");
+
+  simPress(80);
+  simTicks(100);
+  simPress(80);
+  simInput();
+  TEST_ASSERT_TRUE_MESSAGE(inBoostMode, "double-click toggles boost mode");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(UI_CHANGETIP, uiScreen, "double-click does not change the tip");
+  UIOpen(UI_MAIN);
+
+  simPins[Hardware::Button::number] = LOW; // the setup menu opens while the switch is held
+  simPorts(true);
+  simTicks(BUTTON_DEBOUNCE + BUTTON_LONG);
+  simInput();
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(UI_SETUP, uiScreen, "no setup menu on long press");
+  simPins[Hardware::Button::number] = HIGH;
+  simPorts(true);
+  simTicks(BUTTON_DOUBLE);
+  INPUTCheck();
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(INPUT_NONE, getButton(), "click after the long press");
+  UIOpen(UI_MAIN);
+
+  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, TEMP_MIN);
+  simTurn(5, 200);
+  TEST_ASSERT_TRUE_MESSAGE(getRotary() == TEMP_MIN + 5 * TEMP_STEP, "slow turn accelerated");
+  simTurn(5, 10);
+  TEST_ASSERT_TRUE_MESSAGE(getRotary() >= TEMP_MIN + 20 * TEMP_STEP, "fast turn not accelerated");
+  setRotary(0, 5, 1, 0);
+  simTurn(3, 10);
+  TEST_ASSERT_TRUE_MESSAGE(getRotary() == 3, "short range accelerated");
+  setRotary(31, 96, 1, 65);
+  simTurn(4, 10);
+  TEST_ASSERT_TRUE_MESSAGE(getRotary() == 65 + 4 * 4, "character range not accelerated");
+}
+
+void test_sample_windows()
+{
+  simStart(CONTROL_PID);
+  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, BENCH_SETPOINT);
+  simRun(2);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(ADC_FAST, adcSamples, "no short windows while ramping");
+  simRun(BENCH_STEP);
+  int16_t low = CurrentTemp, high = CurrentTemp;
+  for (uint32_t frame = 0; frame < 10UL * CONTROL_RATE; frame++)
+  {
+    simFrame();
+    low = min(low, CurrentTemp);
+    high = max(high, CurrentTemp);
+  }
+  printf("hold window %u samples  ripple %dC\n", adcSamples, high - low);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(ADC_HOLD, adcSamples, "no long windows while holding");
+  TEST_ASSERT_TRUE_MESSAGE(high - low <= 2, "ripple at hold too large");
+
+  // the chip temperature is sampled behind the longest window, within the frame
+  ChipTemp = 0;
+  uint32_t iterations = simIterations;
+  chipRequest = true;
+  simFrame();
+  printf("chip reading %.1fms of a %ums frame\n", (simBusy + 0.0) / 1000, CONTROL_PERIOD);
+  TEST_ASSERT_TRUE_MESSAGE(abs(ChipTemp - (int16_t)(SIM_AMBIENT + 5) * 10) <= 10, "chip temperature not read");
+  TEST_ASSERT_TRUE_MESSAGE(simIterations - iterations == 1, "control period lost");
+  TEST_ASSERT_TRUE_MESSAGE(simBusy < FRAME_COUNTS * 16UL, "chip reading exceeds the frame");
+}
+
+// heats up, falls asleep and cools down to the sleep temperature, then wakes up; returns the time
+// from the wake-up until the tip is in the working range and the overshoot in degrees C
+static double simWake(bool preheat, double *overshoot)
+{
+  simStart(CONTROL_PID);
+  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, BENCH_SETPOINT);
+  simRun(BENCH_STEP);
+  inSleepMode = true;
+  simRun(120);
+
+  simPins[Hardware::Switch::number] = LOW; // handle moved
+  while (inSleepMode)
+    simFrame();
+  if (!preheat)
+  { // PID only, as without the thermal model
+    modelBurst = 0;
+    ctrl.SetMode(AUTOMATIC);
+  }
+  double reached = -1, peak = 0;
+  for (uint32_t frame = 0; frame < (uint32_t)BENCH_WAKE * CONTROL_RATE; frame++)
+  {
+    simFrame();
+    if ((reached < 0) && isWorky)
+      reached = (double)(frame + 1) / CONTROL_RATE;
+    peak = max(peak, simHeater);
+  }
+  *overshoot = max(peak - BENCH_SETPOINT, 0.0);
+  return (reached < 0) ? BENCH_WAKE : reached;
+}
+
+void test_wake_preheat()
+{
+  double pidOvershoot, modelOvershoot;
+  double pid = simWake(false, &pidOvershoot);
+  double model = simWake(true, &modelOvershoot);
+  printf("wake-up pid %5.2fs overshoot %4.1fC  pre-heat %5.2fs overshoot %4.1fC  model %u/50 J/K %u mW/K\n", pid,
+         pidOvershoot, model, modelOvershoot, ActiveTip.model[0], ActiveTip.model[1]);
+  TEST_ASSERT_TRUE_MESSAGE(ActiveTip.model[0] && ActiveTip.model[1], "thermal model not learned");
+  TEST_ASSERT_TRUE_MESSAGE(model < BENCH_WAKE, "working temperature not reached");
+  TEST_ASSERT_TRUE_MESSAGE(model <= pid, "pre-heat is slower than PID");
+  TEST_ASSERT_TRUE_MESSAGE(modelOvershoot < pidOvershoot + 1, "pre-heat increases the overshoot");
+}
+
+// writes the catalogue record being written and a store record, as leaving the setup menu does
+static void simStore()
+{
+  updateEEPROM();
+  simMicros += (STORE_DELAY + 1) * 1000UL;
+  while (storePending || tipBusy())
+    EEPROMCheck();
+}
+
+// forgets the tips and the pending writes in RAM and reads them from the EEPROM like a reset
+// does, with the number of EEPROM writes until the power fails
+static void simBoot(int32_t writes)
+{
+  memset(&ActiveTip, 0, sizeof(ActiveTip));
+  CurrentTip = 0;
+  NumberOfTips = 1;
+  tipWritePos = tipWriteSize;
+  storePending = storeWriting = migrateStaged = false;
+  simEEPROMWrites = writes;
+  getEEPROM();
+}
+
+static void simReboot()
+{
+  simBoot(-1);
+}
+
+// boots from an EEPROM image with the power failing after the given number of writes; returns
+// true if the power failed before the boot was done
+static bool simBootFails(const uint8_t *image, int32_t writes)
+{
+  jmp_buf powerFail;
+  memcpy(simEEPROM, image, sizeof(simEEPROM));
+  simPowerFail = &powerFail;
+  bool failed = setjmp(powerFail);
+  if (!failed)
+    simBoot(writes);
+  simPowerFail = NULL;
+  simEEPROMWrites = -1;
+  return failed;
+}
+
+void test_tip_catalogue()
+{
+  TipRecord tip = {"K2.4", {220, 310, 395, 27}, {2816, 128, 256}, {90, 30}, {1, 2, 3, 4, 5, 6}}, unpacked;
+  uint8_t packed[TIP_RECORD];
+  tipPack(&tip, packed);
+  tipUnpack(packed, &unpacked);
+  TEST_ASSERT_TRUE_MESSAGE(!memcmp(&tip, &unpacked, sizeof(tip)), "tip changed by packing");
+
+  simStart(CONTROL_PID);
+  for (uint8_t i = 1; i < TIPMAX; i++)
+  {
+    simStore();
+    AddTipScreen();
+    snprintf(ActiveTip.name, TIPNAMELENGTH, "T%u", i);
+    ActiveTip.cal[0] = 200 + i;
+  }
+  TEST_ASSERT_EQUAL_UINT8(TIPMAX, NumberOfTips);
+  simStore();
+  TEST_ASSERT_TRUE(tipSelect(3));
+  TEST_ASSERT_FALSE_MESSAGE(tipSelect(4), "tip switched while its record is written");
+  simStore();
+  simReboot();
+  TEST_ASSERT_EQUAL_UINT8(TIPMAX, NumberOfTips);
+  TEST_ASSERT_EQUAL_UINT8(3, CurrentTip);
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp(ActiveTip.name, "T3") && (ActiveTip.cal[0] == 203), "current tip lost");
+  tipSelect(TIPMAX - 1);
+  TEST_ASSERT_TRUE_MESSAGE(ActiveTip.cal[0] == 200 + TIPMAX - 1, "last tip lost");
+  simStore();
+  tipSelect(0);
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp(ActiveTip.name, TIPNAME), "first tip lost");
+}
+
+void test_tip_migration()
+{
+  simStart(CONTROL_PID);
+  memset(simEEPROM, 0xFF, sizeof(simEEPROM));
+  CurrentTip = 2;
+  NumberOfTips = 3;
+  uint8_t record[STORE_V2_RECORD] = {2, 7, 0}; // version 2 record in slot 0, under the catalogue
+  uint8_t *p = record + STORE_HEADER;
+  for (uint16_t i = 0; i < STORE_SETTINGS; i++)
+    *p++ = *storeData(i);
+  char names[LEGACY_TIPS][TIPNAMELENGTH] = {};
+  uint16_t cal[LEGACY_TIPS][LEGACY_CALPOINTS + 1], gains[LEGACY_TIPS][3];
+  uint8_t models[LEGACY_TIPS][2];
+  for (uint8_t tip = 0; tip < LEGACY_TIPS; tip++)
+  {
+    snprintf(names[tip], TIPNAMELENGTH, "old%u", tip);
+    for (uint8_t i = 0; i < LEGACY_CALPOINTS; i++)
+      cal[tip][i] = 200 + 100 * i + tip;
+    cal[tip][LEGACY_CALPOINTS] = 25;
+    gains[tip][0] = 1000 + tip;
+    gains[tip][1] = gains[tip][2] = 256;
+    models[tip][0] = 50 + tip;
+    models[tip][1] = 20;
+  }
+  memcpy(p, names, sizeof(names));
+  memcpy(p += sizeof(names), cal, sizeof(cal));
+  memcpy(p += sizeof(cal), gains, sizeof(gains));
+  memcpy(p += sizeof(gains), models, sizeof(models));
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < STORE_V2_RECORD - 2; i++)
+    crc = _crc16_update(crc, record[i]);
+  record[STORE_V2_RECORD - 2] = crc & 0xFF;
+  record[STORE_V2_RECORD - 1] = crc >> 8;
+  memcpy(simEEPROM + STORE_OLD, record, sizeof(record));
+  static uint8_t image[E2END + 1];
+  memcpy(image, simEEPROM, sizeof(image));
+
+  // the power fails after every number of EEPROM writes the migration takes
+  for (int32_t writes = 0;; writes++)
+  {
+    bool failed = simBootFails(image, writes);
+    if (failed)
+      simReboot(); // the migration starts over
+    TEST_ASSERT_EQUAL_UINT8(3, NumberOfTips);
+    TEST_ASSERT_EQUAL_UINT8(2, CurrentTip);
+    TEST_ASSERT_TRUE_MESSAGE(!strcmp(ActiveTip.name, "OLD2") && (ActiveTip.cal[1] == 302) &&
+                                 (ActiveTip.gains[0] == 1002) && (ActiveTip.model[0] == 52),
+                             "current tip not migrated");
+    TipRecord tip;
+    tipLoad(0, &tip);
+    TEST_ASSERT_TRUE_MESSAGE(!strcmp(tip.name, "OLD0") && (tip.cal[2] == 400), "tip not migrated");
+    if (!failed)
+      break;
+  }
+  simReboot();
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp(ActiveTip.name, "OLD2") && (NumberOfTips == 3), "record not stored");
+}
+
+void test_tip_migration_legacy()
+{
+  simStart(CONTROL_PID);
+  memset(simEEPROM, 0xFF, sizeof(simEEPROM));
+  const uint8_t settings[] = {EEPROM_IDENT >> 8, EEPROM_IDENT & 0xFF, 320 >> 8, 320 & 0xFF, 0, 150,
+                              50, 5, 10, 40, 0, CONTROL_PID, 1, 0, 0, 7, LEGACY_TIPS};
+  memcpy(simEEPROM, settings, sizeof(settings)); // legacy layout with all tips, the last one current
+  uint16_t addr = sizeof(settings);
+  for (uint8_t tip = 0; tip < LEGACY_TIPS; tip++)
+  {
+    snprintf((char *)simEEPROM + addr, TIPNAMELENGTH, "L%u", tip);
+    addr += TIPNAMELENGTH;
+    for (uint8_t i = 0; i <= LEGACY_CALPOINTS; i++, addr += 2)
+    {
+      uint16_t value = (i < LEGACY_CALPOINTS) ? 200 + 100 * i + tip : 25;
+      simEEPROM[addr] = value >> 8;
+      simEEPROM[addr + 1] = value & 0xFF;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      uint16_t value = i ? 256 : 1000 + tip;
+      simEEPROM[EEPROM_GAINS + (tip * 3 + i) * 2] = value >> 8;
+      simEEPROM[EEPROM_GAINS + (tip * 3 + i) * 2 + 1] = value & 0xFF;
+    }
+  }
+  static uint8_t image[E2END + 1];
+  memcpy(image, simEEPROM, sizeof(image));
+
+  // the power fails after every number of EEPROM writes the migration takes; the first record
+  // overlaps the gains of the last tips, which have to come from the catalogue then
+  for (int32_t writes = 0;; writes++)
+  {
+    bool failed = simBootFails(image, writes);
+    if (failed)
+      simReboot(); // the migration starts over
+    TEST_ASSERT_EQUAL_UINT8(LEGACY_TIPS, NumberOfTips);
+    TEST_ASSERT_EQUAL_UINT8(7, CurrentTip);
+    TEST_ASSERT_TRUE_MESSAGE(DefaultTemp == 320, "settings lost by a power failure");
+    for (uint8_t i = 0; i < LEGACY_TIPS; i++)
+    {
+      char name[TIPNAMELENGTH];
+      snprintf(name, TIPNAMELENGTH, "L%u", i);
+      TipRecord tip;
+      tipLoad(i, &tip);
+      TEST_ASSERT_TRUE_MESSAGE(!strcmp(tip.name, name) && (tip.cal[1] == 300 + i) && (tip.gains[0] == 1000 + i),
+                               "tip lost by a power failure");
+    }
+    TEST_ASSERT_TRUE_MESSAGE(ActiveTip.gains[0] == 1007, "current tip not migrated");
+    if (!failed)
+      break;
+  }
+  simReboot();
+  TEST_ASSERT_TRUE_MESSAGE((DefaultTemp == 320) && (NumberOfTips == LEGACY_TIPS), "record not stored");
+  simStore();
+  simReboot();
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp(ActiveTip.name, "L7") && (DefaultTemp == 320), "record overwritten");
+}
+
+void test_tip_migration_v3()
+{
+  simStart(CONTROL_PID);
+  memset(simEEPROM, 0xFF, sizeof(simEEPROM));
+  NumberOfTips = TIPMAX + 2; // the last two do not fit into the catalogue
+  CurrentTip = 3;
+  TipBase = V3_TIPS - 10; // the ring wraps around
+  TipRecord tip = {};
+  uint8_t packed[TIP_RECORD];
+  for (uint8_t i = 0; i < NumberOfTips; i++)
+  {
+    snprintf(tip.name, TIPNAMELENGTH, "T%u", i);
+    for (uint8_t j = 0; j < CALPOINTS; j++)
+      tip.cal[j] = 200 + 100 * j + i;
+    tip.cal[CALPOINTS] = 25;
+    tipPack(&tip, packed);
+    memcpy(simEEPROM + V3_TIP_START + ((TipBase + i) % V3_TIPS) * V3_TIP_RECORD, packed, V3_TIP_RECORD);
+    if (i == CurrentTip)
+      ActiveTip = tip;
+  }
+  uint8_t record[STORE_V3_RECORD] = {3, 9, 0}; // version 3 record in slot 2
+  for (uint16_t i = 0; i < STORE_V3_RECORD - STORE_HEADER - 2; i++)
+    record[STORE_HEADER + i] = *storeData(i);
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < STORE_V3_RECORD - 2; i++)
+    crc = _crc16_update(crc, record[i]);
+  record[STORE_V3_RECORD - 2] = crc & 0xFF;
+  record[STORE_V3_RECORD - 1] = crc >> 8;
+  memcpy(simEEPROM + STORE_OLD + 2 * STORE_V3_RECORD, record, sizeof(record));
+
+  static uint8_t image[E2END + 1];
+  memcpy(image, simEEPROM, sizeof(image));
+
+  // the power fails after every number of EEPROM writes the migration takes
+  for (int32_t writes = 0;; writes++)
+  {
+    memcpy(simEEPROM, image, sizeof(image));
+    simReboot();
+    TEST_ASSERT_EQUAL_UINT8(TIPMAX, NumberOfTips);
+    TEST_ASSERT_EQUAL_UINT8(3, CurrentTip);
+    TEST_ASSERT_EQUAL_UINT8(0, TipBase);
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(UI_NOTICE, uiScreen, "removed tips not noticed");
+    UIOpen(UI_MAIN);
+    TEST_ASSERT_TRUE_MESSAGE(!strcmp(ActiveTip.name, "T3") && (ActiveTip.cal[1] == 303), "current tip not migrated");
+    simEEPROMWrites = writes;
+    simMicros += (STORE_DELAY + 1) * 1000UL;
+    while ((storePending || tipBusy()) && simEEPROMWrites)
+      EEPROMCheck();
+    if (simEEPROMWrites)
+      break; // done within the writes
+    simReboot();
+    TEST_ASSERT_TRUE_MESSAGE(!strcmp(ActiveTip.name, "T3") && (NumberOfTips == TIPMAX),
+                             "settings lost by a power failure");
+    simStore();
+    for (uint8_t i = 0; i < TIPMAX; i++)
+    {
+      char name[TIPNAMELENGTH];
+      snprintf(name, TIPNAMELENGTH, "T%u", i);
+      tipLoad(i, &tip);
+      TEST_ASSERT_TRUE_MESSAGE(!strcmp(tip.name, name) && (tip.cal[2] == 400 + i) && !tip.usage[USE_SLEEP],
+                               "tip lost by a power failure");
+    }
+  }
+  for (uint8_t i = 0; i < TIPMAX; i++)
+  {
+    char name[TIPNAMELENGTH];
+    snprintf(name, TIPNAMELENGTH, "T%u", i);
+    tipLoad(i, &tip);
+    TEST_ASSERT_TRUE_MESSAGE(!strcmp(tip.name, name) && (tip.cal[2] == 400 + i) && !tip.usage[USE_SLEEP],
+                             "tip not moved");
+  }
+  simReboot();
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp(ActiveTip.name, "T3") && (NumberOfTips == TIPMAX), "record not stored");
+  TEST_ASSERT_FALSE_MESSAGE(tipBusy(), "migration not completed");
+}
+
+void test_tip_usage()
+{
+  uint8_t sleep = time2sleep, off = time2off;
+  simStart(CONTROL_PID);
+  time2sleep = time2off = 0;
+  simEnergy = simOnTime = 0;
+  buttonEvent = INPUT_CLICK; // boost
+  simRun(13 * 60);
+  uint16_t *usage = ActiveTip.usage;
+  double energy = usage[USE_ENERGY] + (double)usageEnergy / USAGE_WH;
+  double heater = (usage[USE_HEATER] + usageHeater / (USAGE_TENTH * 255.0)) * 360;
+  printf("usage  heater %5.0fs (%5.0fs)  energy %4.2fWh (%4.2fWh)  at temperature %u/10h\n", heater, simOnTime,
+         energy, simEnergy / 3600, usage[USE_HOT]);
+  TEST_ASSERT_EQUAL_UINT8(1, usage[USE_BOOST]);
+  TEST_ASSERT_FALSE(inBoostMode);
+  buttonEvent = INPUT_CLICK; // first click of a double-click
+  simFrame();
+  buttonEvent = INPUT_DOUBLE;
+  simFrame();
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(1, usage[USE_BOOST], "boost of a double-click counted");
+  UIOpen(UI_MAIN);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(2, usage[USE_HOT], "time at temperature");
+  TEST_ASSERT_TRUE_MESSAGE(fabs(energy - simEnergy / 3600) < 0.05 * energy, "energy");
+  TEST_ASSERT_TRUE_MESSAGE(fabs(heater - simOnTime) < 0.1 * heater, "heater on time");
+
+  time2sleep = 1;
+  time2off = 2;
+  simRun(2 * 60 + 1);
+  TEST_ASSERT_EQUAL_UINT8(1, usage[USE_SLEEP]);
+  TEST_ASSERT_EQUAL_UINT8(1, usage[USE_OFF]);
+  TEST_ASSERT_TRUE_MESSAGE(storePending, "counters not stored");
+  uint16_t counted[USE_COUNTERS];
+  memcpy(counted, usage, sizeof(counted));
+  simStore();
+  simReboot();
+  TEST_ASSERT_TRUE_MESSAGE(!memcmp(counted, ActiveTip.usage, sizeof(counted)), "counters lost");
+
+  // the remainders are rounded into the tip left, the next one starts from zero
+  usageHeater = USAGE_TENTH * 255 * 3 / 4;
+  usageEnergy = 0;
+  usageHot = USAGE_TENTH / 4;
+  AddTipScreen();
+  UIOpen(UI_MAIN);
+  TEST_ASSERT_TRUE_MESSAGE(!usageHeater && !usageHot && !ActiveTip.usage[USE_HEATER], "remainders counted for the next tip");
+  simStore();
+  TEST_ASSERT_TRUE(tipSelect(0));
+  TEST_ASSERT_TRUE_MESSAGE((ActiveTip.usage[USE_HEATER] == counted[USE_HEATER] + 1) &&
+                               (ActiveTip.usage[USE_HOT] == counted[USE_HOT]),
+                           "remainders not rounded");
+  time2sleep = sleep;
+  time2off = off;
+}
+
+// pulls out the tip and inserts a cold one of the same kind; returns the time in seconds until
+// the main screen is back (0: tip not identified within BENCH_WAKE)
+static double simTipChange()
+{
+  simRemoved = true;
+  simRun(2);
+  simHeater = simTip = SIM_AMBIENT;
+  simRemoved = false;
+  bool asked = false;
+  for (uint32_t frame = 0; frame < (uint32_t)BENCH_WAKE * CONTROL_RATE; frame++)
+  {
+    simFrame();
+    UIHandler();
+    asked |= (uiScreen == UI_CHANGETIP);
+    if (asked && (uiScreen == UI_MAIN))
+      return (double)(frame + 1) / CONTROL_RATE;
+  }
+  return 0;
+}
+
+void test_tip_autoid()
+{
+  simStart(CONTROL_PID);
+  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, BENCH_SETPOINT);
+  simRun(BENCH_STEP); // learns the model of the simulated tip
+  uint8_t learned = ActiveTip.model[0];
+  simStore();
+  AddTipScreen(); // a lighter and a heavier tip
+  ActiveTip.model[0] = learned * 2 / 3;
+  simStore();
+  AddTipScreen();
+  ActiveTip.model[0] = learned * 3 / 2;
+  simStore();
+  UIOpen(UI_MAIN);
+  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, BENCH_SETPOINT);
+
+  double time = simTipChange();
+  printf("auto-ID %5.2fs  model %u/50 J/K  tip %u\n", time, learned, CurrentTip);
+  TEST_ASSERT_TRUE_MESSAGE(time > 0, "tip not identified");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(0, CurrentTip, "wrong tip identified");
+  TEST_ASSERT_TRUE_MESSAGE(time < AUTOID_LEAD / 1000.0 + MODEL_HEAT + 1, "identification too slow");
+  double reached = time;
+  for (; !isWorky && (reached < BENCH_WAKE); reached += 1.0 / CONTROL_RATE)
+    simFrame();
+  printf("auto-ID working temperature %5.2fs after the tip change\n", reached);
+  TEST_ASSERT_TRUE_MESSAGE(reached < BENCH_STEP / 2, "heat-up delayed by the identification");
+
+  // a tip unlike the learned ones is left to the manual selection
+  ActiveTip.model[0] = learned / 3;
+  simStore();
+  tipSelect(1);
+  ActiveTip.model[0] = learned * 3;
+  simStore();
+  tipSelect(2);
+  ActiveTip.model[0] = learned * 4;
+  simStore();
+  TEST_ASSERT_TRUE_MESSAGE(simTipChange() == 0, "unknown tip selected");
+  TEST_ASSERT_EQUAL_UINT8(UI_CHANGETIP, uiScreen);
+  simRun(BENCH_STEP);
+  TEST_ASSERT_TRUE_MESSAGE(isWorky, "PID not handed over");
+}
+
+void test_calibration()
+{
+  // points exactly on the default curve, none at the knots: the fit has to find the knots
+  simStart(CONTROL_PID);
+  for (uint8_t i = 0; i < CAL_STEPS; i++)
+  {
+    uiCalADC[i] = (150 + 50 * i) * 64;
+    uiCalMeasured[i] = lround(simSensorTemp(150 + 50 * i));
+    uiCalChip[i] = 250;
+  }
+  TEST_ASSERT_TRUE(calibrationFit(CAL_STEPS));
+  TEST_ASSERT_TRUE_MESSAGE((abs(uiCalTemp[0] - TEMP200) <= 1) && (abs(uiCalTemp[1] - TEMP280) <= 1) &&
+                               (abs(uiCalTemp[2] - TEMP360) <= 1) && (uiCalTemp[CALPOINTS] == 25),
+                           "least squares fit off");
+
+  // session on the simulated tip
+  const uint16_t wrong[CALPOINTS + 1] = {236, 318, 420, TEMPCHP}; // sensor reads too low
+  memcpy(ActiveTip.cal, wrong, sizeof(wrong));
+  buildTempTable();
+  CalibrationScreen();
+  for (uint8_t step = 0; step < CAL_STEPS; step++)
+  {
+    simRun(5);
+    double sum = 0; // tip thermometer: mean of the sensor temperature as sampled by the windows
+    for (uint8_t frame = 0; frame < CONTROL_RATE; frame++)
+    {
+      sum += simHeater;
+      simFrame();
+    }
+    while (!isWorky)
+      simFrame();
+    setRotary(100, 500, 1, lround(sum / CONTROL_RATE));
+    buttonEvent = INPUT_CLICK;
+    UIHandler();
+  }
+  printf("calibration %u %u %u at %uC chip (default %u %u %u)\n", uiCalTemp[0], uiCalTemp[1], uiCalTemp[2],
+         uiCalTemp[CALPOINTS], TEMP200, TEMP280, TEMP360);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(UI_STORE, uiScreen, "calibration not fitted");
+  TEST_ASSERT_TRUE_MESSAGE((abs(uiCalTemp[0] - TEMP200) <= 6) && (abs(uiCalTemp[1] - TEMP280) <= 6) &&
+                               (abs(uiCalTemp[2] - TEMP360) <= 6),
+                           "fitted calibration off");
+  TEST_ASSERT_TRUE_MESSAGE(abs(ChipTemp - (int16_t)(SIM_AMBIENT + 5) * 10) <= 10, "chip temperature not read");
+
+  // a long press after one point cancels the session
+  UIOpen(UI_MAIN);
+  CalibrationScreen();
+  while (!isWorky)
+    simFrame();
+  buttonEvent = INPUT_CLICK;
+  UIHandler();
+  buttonEvent = INPUT_LONG;
+  UIHandler();
+  TEST_ASSERT_FALSE_MESSAGE(inCalibMode || (uiScreen == UI_STORE), "calibration not cancelled");
+}
+
+void test_auto_tune()
+{
+  simStart(CONTROL_PID);
+  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, BENCH_SETPOINT);
+  simRun(30); // settled at the working temperature
+  UIOpen(UI_TIP);
+  AutoTuneScreen();
+
+  // the relay switches fully on and off beyond the hysteresis; the cycles from switching on to
+  // switching on again after the first TUNE_SKIP give period and amplitude of the oscillation
+  bool heating = true;
+  uint8_t cycles = 0;
+  uint32_t frame, start = 0, periods = 0;
+  int16_t high = CurrentTemp, low = CurrentTemp, amps = 0;
+  for (frame = 0; inTuneMode && (frame < (TUNE_TIMEOUT + 10) * CONTROL_RATE); frame++)
+  {
+    simFrame();
+    int16_t temp = CurrentTemp;
+    high = max(high, temp);
+    low = min(low, temp);
+    TEST_ASSERT_TRUE_MESSAGE((Output == 0) || (Output == 255), "relay output not fully on or off");
+    bool on = inTuneMode ? (Output == 0) : (tuneState == TUNE_DONE); // the last cycle ends switching on
+    if (on == heating)
+      continue;
+    int16_t limit = on ? (int16_t)Setpoint - TUNE_HYSTERESIS : (int16_t)Setpoint + TUNE_HYSTERESIS;
+    TEST_ASSERT_TRUE_MESSAGE(on ? (temp < limit) : (temp > limit), "relay switched within the hysteresis");
+    heating = on;
+    if (!on)
+      continue;
+    if (++cycles > TUNE_SKIP)
+    {
+      periods += frame - start;
+      amps += high - low;
+    }
+    start = frame;
+    high = low = temp;
+  }
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(TUNE_DONE, tuneState, "auto-tune not completed");
+  TEST_ASSERT_EQUAL_UINT8(TUNE_SKIP + TUNE_CYCLES, cycles);
+  TEST_ASSERT_FALSE(inTuneMode);
+
+  // Ku = 4 * d / (pi * a) with d = 255 / 2 and a = half the amplitude, scaled to the heater power
+  // at GAIN_VIN and GAIN_TEMP, and the Ziegler-Nichols "no overshoot" rule
+  double pu = (double)periods / TUNE_CYCLES / CONTROL_RATE;
+  double power = (double)getHeaterPower(Vin, Setpoint) / getHeaterPower(GAIN_VIN, GAIN_TEMP);
+  double ku = 4 * 127.5 / (M_PI * amps / TUNE_CYCLES / 2) * constrain(power, 0.25, 4.0);
+  double gains[3] = {ku / 5, ku * 0.4 / pu, ku * pu / 15};
+  printf("auto-tune  Ku %.1f  Pu %.2fs  Kp %.2f (%.2f)  Ki %.2f (%.2f)  Kd %.2f (%.2f)  in %.0fs\n", ku, pu,
+         tuneGains[0] / 256.0, gains[0], tuneGains[1] / 256.0, gains[1], tuneGains[2] / 256.0, gains[2],
+         (double)frame / CONTROL_RATE);
+  for (uint8_t i = 0; i < 3; i++)
+    TEST_ASSERT_TRUE_MESSAGE(fabs(tuneGains[i] / 256.0 - gains[i]) < 0.03 * gains[i] + 0.01, "gains off");
+
+  // the gains are stored with the tip when confirmed
+  buttonEvent = INPUT_CLICK;
+  UIHandler();
+  TEST_ASSERT_EQUAL_UINT8(UI_TUNESTORE, uiScreen);
+  setRotary(0, 1, 1, 1); // "Yes"
+  buttonEvent = INPUT_CLICK;
+  UIHandler();
+  TEST_ASSERT_TRUE_MESSAGE(!memcmp(ActiveTip.gains, tuneGains, sizeof(tuneGains)), "gains not stored");
+
+  // a tip far above the setpoint fails the auto-tune right away, the failure is shown
+  UIOpen(UI_TIP);
+  AutoTuneScreen();
+  SetTemp = CurrentTemp - 60;
+  simFrame();
+  TEST_ASSERT_EQUAL_UINT8(TUNE_FAILED, tuneState);
+  TEST_ASSERT_TRUE_MESSAGE(!inTuneMode && (Output == 255), "heater not released");
+  buttonEvent = INPUT_CLICK;
+  UIHandler();
+  TEST_ASSERT_TRUE_MESSAGE((uiScreen == UI_MESSAGE) && (uiMessage == TuneFailMessage), "failure not shown");
+
+  // without an oscillation it gives up after TUNE_TIMEOUT
+  UIOpen(UI_TIP);
+  SetTemp = BENCH_SETPOINT;
+  simLoad = 1.0; // the tip cannot reach the setpoint
+  AutoTuneScreen();
+  for (frame = 0; inTuneMode && (frame < (TUNE_TIMEOUT + 10) * CONTROL_RATE); frame++)
+    simFrame();
+  simLoad = 0;
+  printf("auto-tune  failed after %.0fs at %dC\n", (double)frame / CONTROL_RATE, CurrentTemp);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(TUNE_FAILED, tuneState, "auto-tune not timed out");
+  TEST_ASSERT_TRUE_MESSAGE(abs((int32_t)frame - (TUNE_TIMEOUT * CONTROL_RATE + 1)) <= 1, "timeout");
+}
+
+// sends a command line over the serial port and returns what is sent until it is answered
+static const char *simCommand(const char *line)
+{
+  simSerialIn = line;
+  simSerialLength = 0;
+  for (uint8_t pass = 0; (pass < 100) && (*simSerialIn || serialList); pass++)
+    SERIALCheck();
+  simSerialOut[min(simSerialLength, sizeof(simSerialOut) - 1)] = 0;
+  return (const char *)simSerialOut;
+}
+
+void test_serial_commands()
+{
+  simStart(CONTROL_PID);
+  char answer[32];
+  snprintf(answer, sizeof(answer), "deftemp %u\r\n", DefaultTemp);
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp(answer, simCommand("get deftemp\n")), "get");
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("ok\r\n", simCommand("set deftemp 330\r\n")), "set");
+  TEST_ASSERT_TRUE_MESSAGE((DefaultTemp == 330) && storePending, "setting not changed and stored");
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("err range\r\n", simCommand("set deftemp 5\n")), "range");
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("err value\r\n", simCommand("set deftemp hot\n")), "value");
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("err name\r\n", simCommand("set colour 1\n")), "name");
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("err command\r\n", simCommand("reboot\n")), "command");
+  TEST_ASSERT_TRUE_MESSAGE(DefaultTemp == 330, "setting changed by a rejected command");
+  char line[SERIAL_LINE + 8];
+  memset(line, 'x', sizeof(line) - 2);
+  strcpy(line + sizeof(line) - 2, "\n");
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("err length\r\n", simCommand(line)), "line length");
+  UIOpen(UI_INFO);
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("err busy\r\n", simCommand("set temp 300\n")), "set outside the main screen");
+  UIOpen(UI_MAIN);
+
+  // a line received over several passes is answered once it is complete
+  TEST_ASSERT_TRUE_MESSAGE(!*simCommand("get def"), "answer before the end of the line");
+  snprintf(answer, sizeof(answer), "deftemp %u\r\n", DefaultTemp);
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp(answer, simCommand("temp\n")), "split line");
+
+  // a listing is sent one line per pass and completed by "ok"
+  const char *listing = simCommand("get\n");
+  uint8_t lines = 0;
+  for (const char *p = listing; (p = strstr(p, "\r\n")); p += 2)
+    lines++;
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(NUMITEMS(SerialSettings) + 1, lines, "settings listed");
+  TEST_ASSERT_TRUE_MESSAGE(strstr(listing, "deftemp 330\r\n") && !strcmp(listing + strlen(listing) - 4, "ok\r\n"),
+                           "listing");
+
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("ok\r\n", simCommand("telemetry on\n")) && telemetryEnable, "telemetry on");
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("err value\r\n", simCommand("telemetry loud\n")) && telemetryEnable, "telemetry");
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp("ok\r\n", simCommand("telemetry off\n")) && !telemetryEnable, "telemetry off");
+}
+
+// runs the frames of the given time with the telemetry task of the main loop
+static void simTelemetry(double seconds)
+{
+  for (uint32_t frames = seconds * CONTROL_RATE; frames; frames--)
+  {
+    simFrame();
+    TELEMETRYCheck();
+  }
+}
+
+// decodes a COBS encoded block; returns the decoded length (0: invalid block)
+static uint16_t simCobsDecode(const uint8_t *data, uint16_t length, uint8_t *decoded)
+{
+  uint16_t size = 0;
+  for (uint16_t i = 0; i < length;)
+  {
+    uint8_t code = data[i++];
+    if (!code || (i + code - 1 > length))
+      return 0;
+    for (uint8_t j = 1; j < code; j++)
+      decoded[size++] = data[i++];
+    if ((code < 0xFF) && (i < length))
+      decoded[size++] = 0;
+  }
+  return size;
+}
+
+// splits the sent bytes at the 0x00 delimiters like tools/telemetry.py and checks the frames;
+// returns the number of valid frames and the first block that is no frame in text
+static uint8_t simFrames(char *text)
+{
+  uint8_t frames = 0, seq = 0;
+  *text = 0;
+  for (uint16_t begin = 0, end = 0; end < simSerialLength; begin = ++end)
+  {
+    while ((end < simSerialLength) && simSerialOut[end])
+      end++;
+    if (end == begin)
+      continue;
+    uint8_t frame[256];
+    uint16_t size = simCobsDecode(simSerialOut + begin, end - begin, frame);
+    uint8_t crc = 0;
+    for (uint16_t i = 0; i + 1 < size; i++)
+      crc = _crc8_ccitt_update(crc, frame[i]);
+    if ((size != TELEMETRY_SIZE) || (crc != frame[size - 1]) || (frame[0] != TELEMETRY_TYPE))
+    {
+      if (!*text)
+      {
+        memcpy(text, simSerialOut + begin, end - begin);
+        text[end - begin] = 0;
+      }
+      continue;
+    }
+    if (frames && (frame[1] != (uint8_t)(seq + 1)))
+      return 0; // frame lost
+    seq = frame[1];
+    if ((frame[10] | (frame[11] << 8)) != Setpoint)
+      return 0; // fields moved
+    frames++;
+  }
+  return frames;
+}
+
+void test_telemetry()
+{
+  simStart(CONTROL_PID);
+  setRotary(TEMP_MIN, TEMP_MAX, TEMP_STEP, BENCH_SETPOINT);
+  simSerialLength = 0;
+  simTelemetry(1);
+  TEST_ASSERT_TRUE_MESSAGE(!simSerialLength, "telemetry sent after reset");
+
+  // every frame is enclosed in 0x00, so the answer in front of the first one stays apart
+  char text[SERIAL_LINE];
+  simCommand("telemetry on\n");
+  simTelemetry(1);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(TELEMETRY_RATE, simFrames(text), "frames lost");
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp(text, "ok\r\n"), "answer merged with a frame");
+
+  // no frame while a command line is received, the answer follows without one in between
+  simCommand("get def");
+  simTelemetry(1);
+  TEST_ASSERT_TRUE_MESSAGE(!simSerialLength, "frame sent within a command line");
+  snprintf(text, sizeof(text), "deftemp %u\r\n", DefaultTemp);
+  TEST_ASSERT_TRUE_MESSAGE(!strcmp(text, simCommand("temp\n")), "answer");
+  simTelemetry(1);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(TELEMETRY_RATE, simFrames(text), "frames not resumed");
+  simCommand("telemetry off\n");
+}
+
+void test_benchmark_mode()
+{
+  static const char *PhaseNames[] = {"heat", "boost", "load", "sleep"};
+  simStart(CONTROL_PID);
+  BenchmarkScreen();
+  for (uint32_t frame = 0; inBenchMode && (frame < 900UL * CONTROL_RATE); frame++)
+    simFrame();
+  TEST_ASSERT_FALSE(inBenchMode);
+  for (uint8_t i = 0; i < benchCompleted; i++)
+    printf("benchmark %-6s reach %5.1fs  overshoot %3dC  ripple %3dC  duty %3d%%\n", PhaseNames[i],
+           benchResults[i].reach / 10.0, benchResults[i].overshoot, benchResults[i].ripple, benchResults[i].duty);
+  TEST_ASSERT_EQUAL_UINT8(BENCH_PHASES, benchCompleted);
+  TEST_ASSERT_TRUE_MESSAGE(benchResults[1].duty > benchResults[3].duty, "boost needs more power than sleep");
+}
+
+// runs until the health monitor latches a fault or the given time in seconds is over
+static uint8_t simFault(double seconds)
+{
+  for (uint32_t frames = seconds * CONTROL_RATE; frames && !faultCode; frames--)
+    simFrame();
+  return faultCode;
+}
+
+void test_health_monitor()
+{
+  simStart(CONTROL_PID);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(WATCHDOG_TIME, simWatchdog, "watchdog not running");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(FAULT_NONE, simFault(20), "fault while working");
+
+  simStart(CONTROL_PID);
+  simOpen = true;
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(FAULT_HEATER, simFault(HEALTH_TIME + 1), "broken heater not detected");
+  TEST_ASSERT_EQUAL_UINT8(UI_FAULT, uiScreen);
+  simRun(1);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(HEATER_OFF, heaterPWM, "heater not switched off");
+  buttonEvent = INPUT_CLICK; // acknowledged
+  UIHandler();
+  TEST_ASSERT_EQUAL_UINT8(FAULT_NONE, faultCode);
+  TEST_ASSERT_EQUAL_UINT8(UI_MAIN, uiScreen);
+  simOpen = false;
+  simRun(5);
+  TEST_ASSERT_TRUE_MESSAGE(CurrentTemp > 150, "no heating after the reset");
+
+  simStart(CONTROL_PID);
+  simStuck = true;
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(FAULT_RUNAWAY, simFault(30), "stuck MOSFET not detected");
+
+  simStart(CONTROL_PID);
+  simRun(5);
+  simVin = 10; // Vin is only read in every VIN_INTERVAL-th window, which bounds the detection time
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(FAULT_VIN, simFault((VIN_INTERVAL + 1.0) / CONTROL_RATE), "supply drop not detected");
+
+  simStart(CONTROL_PID);
+  simRun(5);
+  simStalled = true;
+  simRun((HEALTH_MISSES + 1.0) / CONTROL_RATE);
+  simStalled = false;
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(FAULT_LOOP, simFault(0.1), "stalled loop not detected");
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_direct);
+  RUN_TEST(test_pid);
+  RUN_TEST(test_load_detect);
+  RUN_TEST(test_sleep_timers);
+  RUN_TEST(test_power_save);
+  RUN_TEST(test_input_events);
+  RUN_TEST(test_sample_windows);
+  RUN_TEST(test_wake_preheat);
+  RUN_TEST(test_tip_catalogue);
+  RUN_TEST(test_tip_migration);
+  RUN_TEST(test_tip_migration_legacy);
+  RUN_TEST(test_tip_migration_v3);
+  RUN_TEST(test_tip_usage);
+  RUN_TEST(test_tip_autoid);
+  RUN_TEST(test_calibration);
+  RUN_TEST(test_auto_tune);
+  RUN_TEST(test_serial_commands);
+  RUN_TEST(test_telemetry);
+  RUN_TEST(test_benchmark_mode);
+  RUN_TEST(test_health_monitor);
+  return UNITY_END();
+}
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+# Telemetry decoder for the SolderingStation2 firmware
+#
+# Reads the COBS framed binary telemetry from the station's UART (or from a
+# raw capture file) and prints one CSV line per frame. Requires pyserial for
+# reading from a serial port; the frames are switched on with the "telemetry on"
+# command after the port is opened.
+#
+# Usage: telemetry.py /dev/ttyUSB0 [baud] > log.csv
+#        telemetry.py capture.bin > log.csv
+#
+# Frame (little endian, before COBS encoding, enclosed in 0x00):
+#   type u8 (0x01), seq u8, time u32 ms, raw u16 (ADC in 1/64), temp i16 C,
+#   setpoint u16 C, output u8 (0: full power, 255: off), vin u16 mV,
+#   chiptemp i16 (1/10 C), flags u8, control type u8, crc8 (CCITT, init 0)
+
+import os
+import struct
+import sys
+import time
+
+TELEMETRY_TYPE = 0x01
+FRAME = struct.Struct("<BBIHhHBHhBB")
+FLAGS = ("sleep", "off", "boost", "worky", "tip", "calib", "tune", "burst")
+FIELDS = ("seq", "time_ms", "raw_adc", "temp", "setpoint", "output", "power",
+          "vin_mv", "chip_temp", "control") + FLAGS + ("dropped",)
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def decode(frame):
+    """returns a dict of the frame values or None for an invalid frame"""
+    data = cobs_decode(frame)
+    if not data or len(data) != FRAME.size + 1 or crc8(data[:-1]) != data[-1]:
+        return None
+    values = FRAME.unpack(data[:-1])
+    if values[0] != TELEMETRY_TYPE:
+        return None
+    _, seq, time, raw, temp, setpoint, output, vin, chip, flags, control = values
+    result = dict(seq=seq, time_ms=time, raw_adc=raw / 64, temp=temp,
+                  setpoint=setpoint, output=output, power=255 - output,
+                  vin_mv=vin, chip_temp=chip / 10, control=control)
+    for bit, name in enumerate(FLAGS):
+        result[name] = (flags >> bit) & 1
+    return result
+
+
+def frames(stream):
+    """splits a byte stream at the 0x00 delimiters; every frame starts and ends with one, so
+    text output of the serial commands in between ends up in a block of its own, which fails
+    the CRC check and is discarded without taking the following frame along"""
+    buffer = bytearray()
+    while True:
+        chunk = stream.read(64)
+        if not chunk:
+            return
+        for byte in chunk:
+            if byte == 0:
+                if buffer:
+                    yield bytes(buffer)
+                buffer.clear()
+            else:
+                buffer.append(byte)
+
+
+def open_source(name, baud):
+    if os.path.isfile(name):
+        return open(name, "rb")
+    import serial
+    port = serial.Serial(name, baud, timeout=1)
+    time.sleep(2)  # opening the port resets the Nano
+    port.write(b"telemetry on\n")
+    return port
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__ or "usage: telemetry.py <port|file> [baud]")
+    baud = int(sys.argv[2]) if len(sys.argv) > 2 else 115200
+    print(",".join(FIELDS))
+    last = None
+    with open_source(sys.argv[1], baud) as stream:
+        for frame in frames(stream):
+            values = decode(frame)
+            if values is None:
+                continue
+            values["dropped"] = 0 if last is None else (values["seq"] - last - 1) & 0xFF
+            last = values["seq"]
+            print(",".join(str(values[name]) for name in FIELDS), flush=True)
+
+
+if __name__ == "__main__":
+    main()